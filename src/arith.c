@@ -0,0 +1,476 @@
+/* arith.c -- integer arithmetic of $(( )) expansions.
+ *
+ * An expression is compiled by a Pratt parser into a small tree of nodes,
+ * kept in one block together with the text it came from. Loop counters
+ * and offsets in scripts evaluate the same few expressions over and over,
+ * so the most recently used trees are cached and located by a hash of
+ * their text, a hit only walks the tree again with the current values of
+ * the variables.
+ *
+ * Values are 32 bit signed integers, computed in unsigned arithmetic so
+ * overflows wrap the same on every target. The operators are those of C,
+ * without assignments and the comma:
+ *
+ *   ?:  ||  &&  |  ^  &  == !=  < <= > >=  << >>  + -  * / %  - + ! ~
+ *
+ * Numbers are decimal, octal with a leading 0 or hexadecimal with 0x. A
+ * name, with or without a '$' in front of it, stands for the value of the
+ * variable, an unset or empty variable is 0.
+ */
+
+#ifdef HAVE_ARITH
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "arith.h"
+#include "push.h"
+
+#define ARITH_CACHE 8  // number of cached expressions
+#define ARITH_DEPTH 32 // nesting limit of parentheses and unary operators
+
+enum {
+  ARITH_NUM, ARITH_VAR, ARITH_NEG, ARITH_NOT, ARITH_INV, ARITH_COND,
+  ARITH_LOR, ARITH_LAND, ARITH_BOR, ARITH_XOR, ARITH_BAND,
+  ARITH_EQ, ARITH_NE, ARITH_LT, ARITH_LE, ARITH_GT, ARITH_GE,
+  ARITH_SHL, ARITH_SHR, ARITH_ADD, ARITH_SUB, ARITH_MUL, ARITH_DIV, ARITH_MOD
+};
+
+#define ARITH_UNARY 12 // precedence of the unary operators
+
+typedef struct {
+  uint8_t  op;
+  uint8_t  len;   // length of the name of a variable
+  uint16_t a;     // operands, offset of the name of a variable
+  uint16_t b;
+  uint16_t c;
+  int32_t  value; // value of a number
+} arith_node_t;
+
+typedef struct {
+  arith_node_t *node; // nodes, followed by the text
+  uint32_t      hash;
+  uint32_t      tick; // last use
+  uint16_t      len;  // length of the text
+  uint16_t      root;
+} arith_entry_t;
+
+typedef struct {
+  const char   *s;
+  uint16_t      len;
+  uint16_t      pos;
+  arith_node_t *node;
+  uint16_t      n;     // number of nodes
+  uint8_t       depth;
+  const char   *err;
+} arith_parser_t;
+
+static const struct {
+  char    s[3];
+  uint8_t op;
+  uint8_t prec;
+} binary[] = {
+  // operators starting with another one come first
+  { "||", ARITH_LOR,  2 }, { "&&", ARITH_LAND, 3 }, { "==", ARITH_EQ,   7 },
+  { "!=", ARITH_NE,   7 }, { "<=", ARITH_LE,   8 }, { ">=", ARITH_GE,   8 },
+  { "<<", ARITH_SHL,  9 }, { ">>", ARITH_SHR,  9 }, { "?",  ARITH_COND, 1 },
+  { "|",  ARITH_BOR,  4 }, { "^",  ARITH_XOR,  5 }, { "&",  ARITH_BAND, 6 },
+  { "<",  ARITH_LT,   8 }, { ">",  ARITH_GT,   8 }, { "+",  ARITH_ADD, 10 },
+  { "-",  ARITH_SUB, 10 }, { "*",  ARITH_MUL, 11 }, { "/",  ARITH_DIV, 11 },
+  { "%",  ARITH_MOD, 11 }
+};
+
+static arith_entry_t  cache[ARITH_CACHE];
+static uint32_t       tick = 0;
+static arith_lookup_t lookup;
+static const char    *error; // set when the evaluation failed
+
+static uint8_t is_alpha(char c) {
+  return ((c == '_') || ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')));
+}
+
+static uint8_t is_digit(char c) {
+  return ((c >= '0') && (c <= '9'));
+}
+
+/* Convert the number at 's', with at most 'len' characters, into 'value'
+ * and store the number of characters it takes in 'n'. Returns 0, if it
+ * isn't a valid number. */
+static uint8_t number(const char *s, uint16_t len, uint16_t *n, int32_t *value) {
+  uint32_t v = 0;
+  uint16_t i = 0;
+  uint8_t base = 10, d;
+
+  if ((len > 1) && (s[0] == '0') && ((s[1] == 'x') || (s[1] == 'X'))) {
+    base = 16;
+    i = 2;
+  } else if ((len > 1) && (s[0] == '0')) {
+    base = 8;
+    i = 1;
+  }
+
+  for (; (i < len) && (is_alpha(s[i]) || is_digit(s[i])); i++) {
+    char c = s[i];
+
+    if (is_digit(c)) {
+      d = c - '0';
+    } else if ((c >= 'a') && (c <= 'f')) {
+      d = c - 'a' + 10;
+    } else if ((c >= 'A') && (c <= 'F')) {
+      d = c - 'A' + 10;
+    } else {
+      return (0);
+    }
+
+    if (d >= base) return (0);
+
+    v = v * base + d;
+  }
+
+  // "0x" alone has no digits
+  if ((base == 16) && (i == 2)) return (0);
+
+  *n = i;
+  *value = (int32_t)v;
+
+  return (1);
+}
+
+static void blanks(arith_parser_t *p) {
+  while ((p->pos < p->len) &&
+         ((p->s[p->pos] == ' ') || (p->s[p->pos] == '\t') || (p->s[p->pos] == '\n'))) {
+    p->pos++;
+  }
+}
+
+static uint16_t node(arith_parser_t *p, uint8_t op, uint16_t a, uint16_t b, uint16_t c) {
+  arith_node_t *e = &p->node[p->n];
+
+  e->op = op;
+  e->a = a;
+  e->b = b;
+  e->c = c;
+
+  return (p->n++);
+}
+
+static uint16_t expr(arith_parser_t *p, uint8_t min);
+
+/* Parse a number, a variable, an expression in parentheses or a unary
+ * operator with its operand. */
+static uint16_t primary(arith_parser_t *p) {
+  const char *s;
+  uint16_t n, left;
+  int32_t value;
+  char c;
+
+  blanks(p);
+
+  if (p->pos == p->len) {
+    p->err = "syntax error";
+    return (0);
+  }
+
+  if (++p->depth > ARITH_DEPTH) {
+    p->err = "expression too deep";
+    return (0);
+  }
+
+  s = p->s + p->pos;
+  c = *s;
+
+  if (c == '(') {
+    p->pos++;
+    left = expr(p, 0);
+    blanks(p);
+
+    if (!p->err && ((p->pos == p->len) || (p->s[p->pos] != ')'))) {
+      p->err = "missing ')'";
+    }
+
+    p->pos++;
+  } else if ((c == '-') || (c == '+') || (c == '!') || (c == '~')) {
+    p->pos++;
+    left = expr(p, ARITH_UNARY);
+
+    if (c != '+') {
+      left = node(p, (c == '-') ? ARITH_NEG : (c == '!') ? ARITH_NOT : ARITH_INV, left, 0, 0);
+    }
+  } else if (is_digit(c)) {
+    if (!number(s, p->len - p->pos, &n, &value)) {
+      p->err = "bad number";
+      return (0);
+    }
+
+    left = node(p, ARITH_NUM, 0, 0, 0);
+    p->node[left].value = value;
+    p->pos += n;
+  } else {
+    // a '$' in front of a name is optional
+    if ((c == '$') && (p->pos + 1 < p->len)) {
+      p->pos++;
+      s++;
+      c = *s;
+    }
+
+    n = 0;
+
+    if (is_digit(c) || (c == '#')) {
+      n = 1;
+    } else {
+      while ((p->pos + n < p->len) && (n < 255) &&
+             (is_alpha(s[n]) || (n && is_digit(s[n])))) {
+        n++;
+      }
+    }
+
+    if (!n) {
+      p->err = "syntax error";
+      return (0);
+    }
+
+    left = node(p, ARITH_VAR, p->pos, 0, 0);
+    p->node[left].len = n;
+    p->pos += n;
+  }
+
+  p->depth--;
+
+  return (left);
+}
+
+/* Parse the operators binding at least as tight as 'min', with their
+ * operands. */
+static uint16_t expr(arith_parser_t *p, uint8_t min) {
+  uint16_t left, mid, right;
+  uint8_t i, size;
+
+  left = primary(p);
+
+  while (!p->err) {
+    blanks(p);
+
+    if (p->pos == p->len) break;
+
+    for (i=0; i<sizeof (binary) / sizeof (binary[0]); i++) {
+      size = binary[i].s[1] ? 2 : 1;
+
+      if ((p->pos + size <= p->len) && !memcmp(p->s + p->pos, binary[i].s, size)) break;
+    }
+
+    if ((i == sizeof (binary) / sizeof (binary[0])) || (binary[i].prec < min)) break;
+
+    p->pos += size;
+
+    if (binary[i].op == ARITH_COND) {
+      mid = expr(p, 0);
+      blanks(p);
+
+      if (p->err) break;
+
+      if ((p->pos == p->len) || (p->s[p->pos] != ':')) {
+        p->err = "missing ':'";
+        break;
+      }
+
+      p->pos++;
+
+      // right associative
+      right = expr(p, binary[i].prec);
+      left = node(p, ARITH_COND, left, mid, right);
+    } else {
+      right = expr(p, binary[i].prec + 1);
+      left = node(p, binary[i].op, left, right, 0);
+    }
+  }
+
+  return (left);
+}
+
+/* Returns the value of the variable of node 'e' in the text 's'. */
+static int32_t variable(const arith_node_t *e, const char *s) {
+  const char *value = lookup ? lookup(s + e->a, e->len) : NULL;
+  uint16_t len, n = 0;
+  uint8_t neg = 0;
+  int32_t v = 0;
+
+  if (!value) return (0);
+
+  while ((*value == ' ') || (*value == '\t')) value++;
+
+  if ((*value == '-') || (*value == '+')) neg = (*value++ == '-');
+
+  len = strlen(value);
+
+  while (len && ((value[len - 1] == ' ') || (value[len - 1] == '\t'))) len--;
+
+  if (len && (!number(value, len, &n, &v) || (n != len))) {
+    error = "bad number";
+    return (0);
+  }
+
+  return (neg ? (int32_t)(0 - (uint32_t)v) : v);
+}
+
+static int32_t eval(const arith_node_t *node, const char *s, uint16_t i) {
+  const arith_node_t *e = &node[i];
+  uint32_t a, b;
+
+  switch (e->op) {
+    case ARITH_NUM:
+      return (e->value);
+    case ARITH_VAR:
+      return (variable(e, s));
+    case ARITH_NEG:
+      return ((int32_t)(0 - (uint32_t)eval(node, s, e->a)));
+    case ARITH_NOT:
+      return (!eval(node, s, e->a));
+    case ARITH_INV:
+      return (~eval(node, s, e->a));
+    case ARITH_COND:
+      return (eval(node, s, e->a) ? eval(node, s, e->b) : eval(node, s, e->c));
+    case ARITH_LOR:
+      return (eval(node, s, e->a) || eval(node, s, e->b));
+    case ARITH_LAND:
+      return (eval(node, s, e->a) && eval(node, s, e->b));
+  }
+
+  a = (uint32_t)eval(node, s, e->a);
+  b = (uint32_t)eval(node, s, e->b);
+
+  switch (e->op) {
+    case ARITH_BOR:  return ((int32_t)(a | b));
+    case ARITH_XOR:  return ((int32_t)(a ^ b));
+    case ARITH_BAND: return ((int32_t)(a & b));
+    case ARITH_EQ:   return (a == b);
+    case ARITH_NE:   return (a != b);
+    case ARITH_LT:   return ((int32_t)a <  (int32_t)b);
+    case ARITH_LE:   return ((int32_t)a <= (int32_t)b);
+    case ARITH_GT:   return ((int32_t)a >  (int32_t)b);
+    case ARITH_GE:   return ((int32_t)a >= (int32_t)b);
+    case ARITH_SHL:  return ((int32_t)(a << (b & 31)));
+    case ARITH_SHR:
+      // shift in the sign, whatever the compiler does with signed values
+      b &= 31;
+      return ((int32_t)((a & 0x80000000ul) && b ? ~(~a >> b) : a >> b));
+    case ARITH_ADD:  return ((int32_t)(a + b));
+    case ARITH_SUB:  return ((int32_t)(a - b));
+    case ARITH_MUL:  return ((int32_t)(a * b));
+  }
+
+  if (!b) {
+    error = "division by zero";
+    return (0);
+  }
+
+  // the one quotient that doesn't fit wraps around
+  if ((a == 0x80000000ul) && (b == 0xfffffffful)) {
+    return ((e->op == ARITH_DIV) ? (int32_t)a : 0);
+  }
+
+  return ((e->op == ARITH_DIV) ? (int32_t)a / (int32_t)b : (int32_t)a % (int32_t)b);
+}
+
+/* Returns the cached tree of the 'len' characters at 'text', compiled
+ * now if it isn't cached. Returns NULL after printing an error. */
+static const arith_entry_t *compile(const char *text, uint16_t len) {
+  arith_entry_t *c = &cache[0];
+  arith_parser_t p;
+  uint32_t hash = 2166136261u;
+  uint16_t i;
+
+  for (i=0; i<len; i++) hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+
+  for (i=0; i<ARITH_CACHE; i++) {
+    arith_entry_t *e = &cache[i];
+
+    if (e->node && (e->hash == hash) && (e->len == len) &&
+        !memcmp(e->node + e->len + 1, text, len)) {
+      e->tick = ++tick;
+      return (e);
+    }
+
+    // the least recently used one makes room
+    if (!e->node || (c->node && (e->tick < c->tick))) c = e;
+  }
+
+  // every node takes at least one character of the text
+  if (len >= 0xffff / sizeof (arith_node_t)) {
+    printf("%.*s: expression too long\n", len, text);
+    return (NULL);
+  }
+
+  memset(&p, 0, sizeof (p));
+  p.s = text;
+  p.len = len;
+
+  if (!(p.node = (arith_node_t *)malloc((len + 1) * sizeof (arith_node_t) + len))) {
+    printf("out of memory\n");
+    return (NULL);
+  }
+
+  i = expr(&p, 0);
+  blanks(&p);
+
+  if (!p.err && (p.pos < p.len)) p.err = "syntax error";
+
+  if (p.err) {
+    printf("%.*s: %s\n", len, text, p.err);
+    free(p.node);
+    return (NULL);
+  }
+
+  free(c->node);
+
+  c->node = p.node;
+  c->hash = hash;
+  c->tick = ++tick;
+  c->len  = len;
+  c->root = i;
+
+  memcpy(c->node + len + 1, text, len);
+
+  return (c);
+}
+
+/* Evaluate the 'len' characters of the expression at 'text' into 'value',
+ * the values of variables are taken from 'fn'. Returns 0 after printing
+ * an error. */
+uint8_t arith_eval(const char *text, uint16_t len, arith_lookup_t fn, int32_t *value) {
+  const arith_entry_t *e;
+  uint16_t i;
+
+  // an empty expression is 0
+  for (i=0; (i < len) && ((text[i] == ' ') || (text[i] == '\t') || (text[i] == '\n')); i++);
+
+  if (i == len) {
+    *value = 0;
+    return (1);
+  }
+
+  if (!(e = compile(text, len))) return (0);
+
+  lookup = fn;
+  error = NULL;
+
+  *value = eval(e->node, (const char *)(e->node + e->len + 1), e->root);
+
+  if (error) {
+    printf("%.*s: %s\n", len, text, error);
+    return (0);
+  }
+
+  return (1);
+}
+
+void arith_fini(void) {
+  uint8_t i;
+
+  for (i=0; i<ARITH_CACHE; i++) free(cache[i].node);
+
+  memset(cache, 0, sizeof (cache));
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _ARITH_H_
+#define _ARITH_H_
+
+#include <stdint.h>
+
+/* Returns the value of the variable 'name' of length 'len', or NULL. */
+typedef const char *(*arith_lookup_t)(const char *name, uint8_t len);
+
+uint8_t arith_eval(const char *expr, uint16_t len, arith_lookup_t lookup, int32_t *value);
+void    arith_fini(void);
+
+#endif // _ARITH_H_
@@ -8,12 +8,31 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_EXEC
+#include <fcntl.h>
+#include <signal.h>
+
+#include "exec.h"
+#endif
+
 #include "fileio.h"
+#include "cmdtab.h"
+#include "cmdcache.h"
+#include "var.h"
+#include "glob.h"
+#include "arith.h"
+#include "script.h"
+#include "dircache.h"
+#include "fuzzy.h"
 #include "parse.h"
 #include "lined.h"
 #include "term.h"
 #include "cli.h"
 
+#ifdef HAVE_SHARED_HISTORY
+#include "histfile.h"
+#endif
+
 #include "push.h"
 
 #define _mkstr_(_s_)  #_s_
@@ -25,7 +44,8 @@ static const char *commands =
   "cd\0"       "ls\0"       "mv\0"       "rm\0" 
   "realpath\0" "basename\0" "dirname\0"  "mkdir\0"
   "rmdir\0"    "parse\0"    "test\0"     "logout\0"
-  "exit\0"
+  "exit\0"     "cat\0"      "export\0"   "unset\0"
+  "source\0"
   "\0" // end marker
 ;
 
@@ -72,12 +92,18 @@ static const char *input =
 
 #endif // ZX
 
-static void not_implemented(const char *cmd) {
+#ifdef HAVE_EXEC
+static uint8_t status = 0; // exit status of the last external command
+#endif
+
+static uint8_t not_implemented(const char *cmd) {
   printf("%s: not implemented\n", cmd);
+  return (1);
 }
 
-static void missing_arg(const char *cmd) {
+static uint8_t missing_arg(const char *cmd) {
   printf("%s: missing argument\n", cmd);
+  return (1);
 }
 
 #ifdef OSCAR64
@@ -94,7 +120,7 @@ static void perror(const char *s) {
 }
 #endif
 
-static void cmd_help(uint8_t argc, char **argv) {
+static uint8_t cmd_help(uint8_t argc, char **argv) {
   const char *ptr = commands;
   uint8_t cols, rows, n = 1;
 
@@ -126,17 +152,21 @@ static void cmd_help(uint8_t argc, char **argv) {
   printf("line editor keys ([ctrl]+[x]):\n");
   printf(KEYS);
   printf("\n");
+
+  return (0);
 }
 
-static void cmd_parse(uint8_t argc, char **argv) {
+static uint8_t cmd_parse(uint8_t argc, char **argv) {
   uint8_t i;
 
   for (i=0; i<argc; i++) {
     printf("argv[%d]='%s'\n", i, argv[i]);
   }
+
+  return (0);
 }
 
-static void cmd_echo(uint8_t argc, char **argv) {
+static uint8_t cmd_echo(uint8_t argc, char **argv) {
   uint8_t i;
 
   for (i=1; i<argc; i++) {
@@ -144,61 +174,86 @@ static void cmd_echo(uint8_t argc, char **argv) {
     if (i < argc - 1) printf(" ");
   }
   printf("\n");
+
+  return (0);
 }
 
-static void cmd_version(uint8_t argc, char **argv) {
+static uint8_t cmd_version(uint8_t argc, char **argv) {
   printf("push, version "
     mkstr(VERSION)   " ("
     mkstr(MACHINE)   "-"
     mkstr(TOOLCHAIN) ")\n"
   );
+
+  return (0);
 }
 
-static void cmd_clear(uint8_t argc, char **argv) {
+static uint8_t cmd_clear(uint8_t argc, char **argv) {
   term_clear_screen();
+
+  return (0);
 }
 
-static void cmd_sleep(uint8_t argc, char **argv) {
+static uint8_t cmd_sleep(uint8_t argc, char **argv) {
   if (argc < 2) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
   }
 
   sleep(atoi(argv[1]));
+
+  return (0);
 }
 
-static void cmd_mv(uint8_t argc, char **argv) {
+static uint8_t cmd_mv(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
   if (argc < 3) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
   }
 
   if (rename(argv[1], argv[2])) {
     perror(*argv);
+    return (1);
   }
+
+  return (0);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_rm(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
-  uint8_t flags;
-  char *path;
+static const parse_opt_t verbose_opts[] = {
+  { '?', "help",    0 },
+  { 'v', "verbose", 0 },
+  { 0,   NULL,      0 }
+};
+
+// the order is that of the flags of fileio_ls()
+static const parse_opt_t ls_opts[] = {
+  { '?', "help", 0 },
+  { 'a', "all",  0 },
+  { 'l', NULL,   0 },
+  { '1', NULL,   0 },
+  { 0,   NULL,   0 }
+};
+#endif
 
-  flags = parse_optflags(argc, argv, "?v");
+static uint8_t cmd_rm(uint8_t argc, char **argv) {
+#ifdef HAVE_FILEIO
+  uint8_t i, ret = 0;
+  uint16_t flags;
+  char *path;
 
-  if (flags & 0x01) { // ?
+  if (!(i = parse_options(argc, argv, verbose_opts, &flags, NULL)) ||
+      (flags & 0x01)) { // ?
     printf("usage: %s [-v] name\n", *argv);
-    return;
+    return (1);
   }
 
-  argv += optind;
+  argv += i;
 
   if (!*argv) {
-    missing_arg("rm");
-    return;
+    return (missing_arg("rm"));
   }
 
   do {
@@ -210,30 +265,32 @@ static void cmd_rm(uint8_t argc, char **argv) {
 
     if (unlink(path)) {
       perror("rm");
+      ret = 1;
     }
   } while (*++argv);
+
+  return (ret);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_mkdir(uint8_t argc, char **argv) {
+static uint8_t cmd_mkdir(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
-  uint8_t flags;
+  uint8_t i, ret = 0;
+  uint16_t flags;
   char *path;
 
-  flags = parse_optflags(argc, argv, "?v");
-
-  if (flags & 0x01) { // ?
+  if (!(i = parse_options(argc, argv, verbose_opts, &flags, NULL)) ||
+      (flags & 0x01)) { // ?
     printf("usage: %s [-v] name\n", *argv);
-    return;
+    return (1);
   }
 
-  argv += optind;
+  argv += i;
 
   if (!*argv) {
-    missing_arg("mkdir");
-    return;
+    return (missing_arg("mkdir"));
   }
 
   do {
@@ -247,30 +304,32 @@ static void cmd_mkdir(uint8_t argc, char **argv) {
 
     if (fileio_mkdir(path)) {
       fileio_error("mkdir");
+      ret = 1;
     }
   } while (*++argv);
+
+  return (ret);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_rmdir(uint8_t argc, char **argv) {
+static uint8_t cmd_rmdir(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
-  uint8_t flags;
+  uint8_t i, ret = 0;
+  uint16_t flags;
   char *path;
 
-  flags = parse_optflags(argc, argv, "?v");
-
-  if (flags & 0x01) { // ?
+  if (!(i = parse_options(argc, argv, verbose_opts, &flags, NULL)) ||
+      (flags & 0x01)) { // ?
     printf("usage: %s [-v] name\n", *argv);
-    return;
+    return (1);
   }
 
-  argv += optind;
+  argv += i;
 
   if (!*argv) {
-    missing_arg("rmdir");
-    return;
+    return (missing_arg("rmdir"));
   }
 
   do {
@@ -282,83 +341,122 @@ static void cmd_rmdir(uint8_t argc, char **argv) {
 
     if (fileio_rmdir(path)) {
       fileio_error("rmdir");
+      ret = 1;
     }
   } while (*++argv);
+
+  return (ret);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_pwd(uint8_t argc, char **argv) {
+static uint8_t cmd_pwd(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
   char *pwd;
 
   pwd = fileio_getcwd(scratch, sizeof (scratch));
 
-  if (pwd) {
-    printf("%s\n", pwd);
-  } else {
+  if (!pwd) {
     perror(*argv);
+    return (1);
   }
+
+  printf("%s\n", pwd);
+
+  return (0);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_realpath(uint8_t argc, char **argv) {
+static uint8_t cmd_realpath(uint8_t argc, char **argv) {
+  uint16_t size;
+  char *path;
+
   if (argc < 2) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
   }
 
-  printf("%s\n", parse_realpath(argv[1]));
+  // the result is never longer than the argument, or "."
+  size = strlen(argv[1]) + 2;
+
+  if (!(path = (char *)malloc(size))) {
+    printf("%s: out of memory\n", *argv);
+    return (1);
+  }
+
+  parse_realpath(path, argv[1], size);
+  printf("%s\n", path);
+
+  free(path);
+
+  return (0);
 }
 
-static void cmd_basename(uint8_t argc, char **argv) {
+static uint8_t cmd_basename(uint8_t argc, char **argv) {
   if (argc < 2) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
   }
 
   printf("%s\n", parse_basename(argv[1]));
+
+  return (0);
 }
 
-static void cmd_dirname(uint8_t argc, char **argv) {
+static uint8_t cmd_dirname(uint8_t argc, char **argv) {
+  uint16_t size;
+  char *path;
+
   if (argc < 2) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
+  }
+
+  // the result is never longer than the argument, or "."
+  size = strlen(argv[1]) + 2;
+
+  if (!(path = (char *)malloc(size))) {
+    printf("%s: out of memory\n", *argv);
+    return (1);
   }
 
-  printf("%s\n", parse_dirname(argv[1]));
+  parse_dirname(path, argv[1], size);
+  printf("%s\n", path);
+
+  free(path);
+
+  return (0);
 }
 
-static void cmd_cd(uint8_t argc, char **argv) {
+static uint8_t cmd_cd(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
   if (argc < 2) {
-    missing_arg(*argv);
-    return;
+    return (missing_arg(*argv));
   }
 
   if (fileio_chdir(argv[1])) {
     fileio_error(*argv);
+    return (1);
   }
+
+  return (0);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_ls(uint8_t argc, char **argv) {
+static uint8_t cmd_ls(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
-  uint8_t header, flags;
+  uint8_t header, i, ret = 0;
+  uint16_t flags;
 
-  flags = parse_optflags(argc, argv, "?al1");
-
-  if (flags & 0x01) { // ?
+  if (!(i = parse_options(argc, argv, ls_opts, &flags, NULL)) ||
+      (flags & 0x01)) { // ?
     printf("usage: %s [-a] [-l] [-1] [path]\n", *argv);
-    return;
+    return (1);
   }
 
-  argv += optind;
+  argv += i;
 
   header = (argv[0] && argv[1]);
 
@@ -368,158 +466,1452 @@ static void cmd_ls(uint8_t argc, char **argv) {
     if (!path) path = ".";
     if (header) printf("%s:\n", path);
 
-    fileio_ls(flags, path);
+    if (fileio_ls((uint8_t)flags, path)) ret = 1;
 
     if (header && argv[1]) printf("\n");
-  } while (*++argv);
+  } while (*argv && *++argv);
+
+  return (ret);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-static void cmd_mount(uint8_t argc, char **argv) {
+static uint8_t cmd_cat(uint8_t argc, char **argv) {
 #ifdef HAVE_FILEIO
-  fileio_mount(NULL, NULL);
+  uint8_t i = 1, ret = 0;
+  int8_t err;
+
+  do {
+    const char *path = (i < argc) ? argv[i] : NULL;
+
+    if ((err = fileio_cat(path)) < 0) fileio_error(path ? path : *argv);
+    if (err) ret = 1;
+  } while (++i < argc);
+
+  return (ret);
 #else
-  not_implemented(*argv);
+  return (not_implemented(*argv));
 #endif
 }
 
-void lined_complete_cb(lined_t *l) {
-#ifdef HAVE_COMPLETION
-  const char *ptr = commands;
-  const char *c = l->buf;
-  uint8_t spaces = 0;
+#ifdef HAVE_VARS
+/* Check that 'arg' is a variable name, optionally followed by '=' and a
+ * value. Returns the length of the name, 0 if it's not valid. */
+static uint8_t var_arg(const char *cmd, const char *arg, uint8_t value) {
+  uint8_t len = var_name(arg);
 
-  // remove all the leading spaces
-  while (c && (*c == ' ')) {
-    spaces++;
-    c++;
+  if (!len || (arg[len] && (!value || (arg[len] != '=')))) {
+    printf("%s: %s: bad variable name\n", cmd, arg);
+    return (0);
   }
 
-  // TAB completion requires at least one character
-  if (strlen(c) < 1) return;
+  return (len);
+}
 
-  if (!strncmp(c, "echo", 4)) {
-    lined_completion_add(l, "echo foo bar");
+/* Look up variable 'name' of length 'len' for expansions. */
+static const char *var_lookup(const char *name, uint8_t len) {
+  static char code[12];
+
+#ifdef HAVE_EXEC
+  if ((len == 1) && (*name == '?')) {
+    sprintf(code, "%u", status);
+    return (code);
+  }
+#endif
+#ifdef HAVE_SCRIPT
+  if ((len == 1) && ((*name == '#') || ((*name >= '0') && (*name <= '9')))) {
+    return (script_arg(*name));
+  }
+#endif
+  if ((len == 1) && (*name == '$')) {
+    sprintf(code, "%ld", (long)getpid());
+    return (code);
   }
 
-  while (*ptr) {
-    if (!strncmp(ptr, c, strlen(c))) {
-      lined_completion_add(l, ptr);
+  return (var_get(name, len));
+}
+#endif
+
+static uint8_t cmd_export(uint8_t argc, char **argv) {
+#ifdef HAVE_VARS
+  uint8_t i, len, ret = 0;
+  char **e;
+
+  if (argc < 2) {
+    for (e = var_envp(); e && *e; e++) printf("%s\n", *e);
+    return (0);
+  }
+
+  for (i=1; i<argc; i++) {
+    if (!(len = var_arg(*argv, argv[i], 1))) {
+      ret = 1;
+      continue;
     }
 
-    ptr += strlen(ptr) + 1;
+    if (argv[i][len]) {
+      var_set(argv[i], len, argv[i] + len + 1, VAR_EXPORT);
+    } else {
+      var_export(argv[i], len);
+    }
   }
+
+  return (ret);
+#else
+  return (not_implemented(*argv));
 #endif
 }
 
-#ifdef HAVE_HINTS
-const char *term_hint_cb(lined_t *l) {
-  const char *c = l->buf;
+static uint8_t cmd_unset(uint8_t argc, char **argv) {
+#ifdef HAVE_VARS
+  uint8_t i, len, ret = 0;
 
-  // remove all the leading spaces
-  while (c && (*c == ' ')) c++;
+  for (i=1; i<argc; i++) {
+    if ((len = var_arg(*argv, argv[i], 0))) {
+      var_unset(argv[i], len);
+    } else {
+      ret = 1;
+    }
+  }
+
+  return (ret);
+#else
+  return (not_implemented(*argv));
+#endif
+}
+
+static uint8_t cmd_source(uint8_t argc, char **argv) {
+#ifdef HAVE_SCRIPT
+  if (argc < 2) {
+    return (missing_arg(*argv));
+  }
 
-  if (!strcmp(c, "cd"))       return ("<path>");
-  if (!strcmp(c, "mv"))       return ("<old> <new>");
-  if (!strcmp(c, "rm"))       return ("<name>");
-  if (!strcmp(c, "mkdir"))    return ("<dir>");
-  if (!strcmp(c, "rmdir"))    return ("<dir>");
-  if (!strcmp(c, "realpath")) return ("<path>");
-  if (!strcmp(c, "basename")) return ("<path>");
-  if (!strcmp(c, "dirname"))  return ("<path>");
-  if (!strcmp(c, "mount"))    return ("[<dir>] [<dev>]");
-  if (!strcmp(c, "parse"))    return ("[<arg1> <arg2> ...]");
-  if (!strcmp(c, "echo"))     return ("[<text1> <text2> ...]");
-  if (!strcmp(c, "sleep"))    return ("<sec>");
+  script_source(argc - 1, argv + 1);
 
-  return (NULL);
+  // the status of the script's last command
+  return (cli_status());
+#else
+  return (not_implemented(*argv));
+#endif
 }
+
+static uint8_t cmd_mount(uint8_t argc, char **argv) {
+#ifdef HAVE_FILEIO
+  fileio_mount(NULL, NULL);
+
+  return (0);
+#else
+  return (not_implemented(*argv));
 #endif
+}
+
+#define BUILTIN_EXIT   0    // builtins handled by cli_exec() itself
+#define BUILTIN_LOGOUT 1
+#define BUILTIN_RESET  2
+#define BUILTIN_TEST   3
+#define BUILTIN_NONE   0xff // not a builtin
+
+typedef struct builtin_t {
+  const char *name;
+  uint8_t   (*run)(uint8_t argc, char **argv); /* Returns the status. */
+} builtin_t;
+
+static const builtin_t builtins[] = {
+  { "exit",     NULL          },
+  { "logout",   NULL          },
+  { "reset",    NULL          },
+  { "test_",    NULL          },
+  { "cd",       cmd_cd        },
+  { "ls",       cmd_ls        },
+  { "mv",       cmd_mv        },
+  { "rm",       cmd_rm        },
+  { "mkdir",    cmd_mkdir     },
+  { "rmdir",    cmd_rmdir     },
+  { "pwd",      cmd_pwd       },
+  { "realpath", cmd_realpath  },
+  { "basename", cmd_basename  },
+  { "dirname",  cmd_dirname   },
+  { "mount",    cmd_mount     },
+  { "clear",    cmd_clear     },
+  { "sleep",    cmd_sleep     },
+  { "echo",     cmd_echo      },
+  { "version",  cmd_version   },
+  { "help",     cmd_help      },
+  { "parse",    cmd_parse     },
+  { "cat",      cmd_cat       },
+  { "export",   cmd_export    },
+  { "unset",    cmd_unset     },
+  { "source",   cmd_source    },
+};
+
+#define BUILTINS (sizeof (builtins) / sizeof (builtin_t))
+
+static uint8_t builtin_find(const char *name) {
+  uint8_t i;
 
-uint8_t cli_exec(char *cmd) {
-  char *argv[8];
-  uint8_t argc;
+  for (i=0; i<BUILTINS; i++) {
+    if (!strcmp(builtins[i].name, name)) return (i);
+  }
 
-#ifdef POSIX
-  char *com = strdup(cmd);
+  return (BUILTIN_NONE);
+}
+
+#ifdef HAVE_SERVER
+/* Returns non-zero, if builtin 'cmd' changes the state of the shell. */
+static uint8_t builtin_state(uint8_t cmd) {
+  uint8_t (*run)(uint8_t argc, char **argv) = builtins[cmd].run;
+
+  return (!run || (run == cmd_cd) || (run == cmd_source) ||
+          (run == cmd_export) || (run == cmd_unset));
+}
 #endif
 
-  argc = parse_command(cmd, argv, 8);
+#ifdef HAVE_COMPLETION
+/* Add the buffer up to 'head', followed by 'name', as a candidate. The
+ * names of directories get a trailing slash. */
+static void complete_add(lined_t *l, char *buf, uint8_t head, const char *name, uint8_t type) {
+  size_t size = strlen(name);
+
+  if (head + size + 1 >= LINED_LENGTH) return;
 
-  if (argc == 0) return (0);
+  memcpy(buf + head, name, size);
+#ifdef HAVE_DIRCACHE
+  if (type & DIRCACHE_DIR) buf[head + size++] = '/';
+#endif
+  buf[head + size] = '\0';
 
-  if (!strcmp(*argv, "exit") || !strcmp(*argv, "logout")) {
-    return (1); // exit
-  } else if (!strcmp(*argv, "reset")) {
-    return (2); // reset
-  } else if (!strcmp(*argv, "cd")) {
-    cmd_cd(argc, argv);
-  } else if (!strcmp(*argv, "ls")) {
-    cmd_ls(argc, argv);
-  } else if (!strcmp(*argv, "mv")) {
-    cmd_mv(argc, argv);
-  } else if (!strcmp(*argv, "rm")) {
-    cmd_rm(argc, argv);
-  } else if (!strcmp(*argv, "mkdir")) {
-    cmd_mkdir(argc, argv);
-  } else if (!strcmp(*argv, "rmdir")) {
-    cmd_rmdir(argc, argv);
-  } else if (!strcmp(*argv, "pwd")) {
-    cmd_pwd(argc, argv);
-  } else if (!strcmp(*argv, "realpath")) {
-    cmd_realpath(argc, argv);
-  } else if (!strcmp(*argv, "basename")) {
-    cmd_basename(argc, argv);
-  } else if (!strcmp(*argv, "dirname")) {
-    cmd_dirname(argc, argv);
-  } else if (!strcmp(*argv, "mount")) {
-    cmd_mount(argc, argv);
-  } else if (!strcmp(*argv, "clear")) {
-    cmd_clear(argc, argv);
-  } else if (!strcmp(*argv, "sleep")) {
-    cmd_sleep(argc, argv);
-  } else if (!strcmp(*argv, "echo")) {
-    cmd_echo(argc, argv);
-  } else if (!strcmp(*argv, "version")) {
-    cmd_version(argc, argv);
-  } else if (!strcmp(*argv, "help")) {
-    cmd_help(argc, argv);
-  } else if (!strcmp(*argv, "parse")) {
-    cmd_parse(argc, argv);
-  } else if (!strcmp(*argv, "test_")) {
-    term_push_keys(input);
-  } else {
-#if !defined(KICKC) && !defined(OSCAR64)
-    if ((argv[0][0] == '$') || (argv[0][0] == '.')) {
-      argc = parse_command("ls -la $", argv, 8);
-      cmd_ls(argc, argv); return (0);
-    } else if ((argv[0][0] == '.') && (argv[0][1] == '.')) {
-      argc = parse_command("cd ..", argv, 8);
-      cmd_cd(argc, argv); return (0);
-    } else if (argv[0][0] == '/') {
-      argc = parse_command("cd /", argv, 8);
-      cmd_cd(argc, argv); return (0);
+  lined_completion_add(l, buf);
+}
+#endif
+
+#ifdef HAVE_FUZZY
+
+#define FUZZY_TOP  32  // number of ranked candidates offered
+#define FUZZY_USES 256 // slots of the command usage table, power of 2
+
+/* A candidate of fuzzy completion. The name is copied, as the listings
+ * it comes from may move or be dropped between steps. */
+typedef struct ranked_t {
+  char     name[LINED_LENGTH]; /* Candidate name. */
+  uint16_t cost;               /* Match quality, lower is better. */
+  uint16_t uses;               /* How often it has been used as a command. */
+  uint8_t  type;               /* Type of directory entries. */
+} ranked_t;
+
+/* How often a command has been used, summed up over the history. */
+typedef struct usage_t {
+  const char *word;  /* Command name, pointing into the history line. */
+  uint8_t     len;   /* Length of the command name. */
+  uint16_t    uses;  /* Number of uses. */
+} usage_t;
+
+/* The state of a fuzzy search, one per editor, kept in its context. */
+typedef struct rank_t {
+  fuzzy_t  fuzzy;              /* Compiled search pattern. */
+  ranked_t ranked[FUZZY_TOP];  /* Best candidates so far, best first. */
+  uint8_t  n;                  /* Number of ranked candidates. */
+  usage_t  usage[FUZZY_USES];  /* Command usage table. */
+} rank_t;
+
+static uint16_t usage_slot(rank_t *r, const char *word, uint8_t len) {
+  uint16_t i, h = 5381;
+
+  for (i=0; i<len; i++) h = (h << 5) + h + (uint8_t)word[i];
+
+  h &= FUZZY_USES - 1;
+
+  while (r->usage[h].word) {
+    if ((r->usage[h].len == len) && !strncmp(r->usage[h].word, word, len)) break;
+
+    h = (h + 1) & (FUZZY_USES - 1);
+  }
+
+  return (h);
+}
+
+/* Count the uses of the first words of all history lines. */
+static void usage_build(lined_t *l) {
+  rank_t *r = (rank_t *)l->ctx;
+  const char *line;
+  uint16_t uses;
+  uint8_t i = 0;
+
+  memset(r->usage, 0, sizeof (r->usage));
+
+  while ((line = lined_history_get(l->history, i++, &uses))) {
+    uint8_t len = 0;
+    uint16_t h;
+
+    while (*line == ' ') line++;
+    while (line[len] && (line[len] != ' ')) len++;
+
+    if (!len) continue;
+
+    h = usage_slot(r, line, len);
+    r->usage[h].word  = line;
+    r->usage[h].len   = len;
+    r->usage[h].uses += uses;
+  }
+}
+
+/* Rate 'name' and keep it, if it is among the best FUZZY_TOP candidates.
+ * Better matches rank first, equally good matches by frequency of use. */
+static void rank_name(lined_t *l, const char *name, uint8_t type, uint8_t command) {
+  rank_t *r = (rank_t *)l->ctx;
+  size_t len = strlen(name);
+  ranked_t *ranked;
+  uint16_t cost, uses = 0;
+  uint8_t i;
+
+  // longer names don't fit in the line anyway
+  if (len >= LINED_LENGTH) return;
+
+  if (!r || ((cost = fuzzy_score(&r->fuzzy, name)) == FUZZY_NONE)) return;
+
+  ranked = r->ranked;
+  i = r->n;
+
+  if (command) {
+    uses = r->usage[usage_slot(r, name, (uint8_t)len)].uses;
+  }
+
+  if (r->n == FUZZY_TOP) {
+    ranked_t *worst = &ranked[FUZZY_TOP - 1];
+
+    if ((cost > worst->cost) || ((cost == worst->cost) && (uses <= worst->uses))) {
+      return;
     }
+
+    i--;
+  } else {
+    r->n++;
+  }
+
+  while ((i > 0) && ((ranked[i-1].cost > cost) ||
+         ((ranked[i-1].cost == cost) && (ranked[i-1].uses < uses)))) {
+    ranked[i] = ranked[i-1];
+    i--;
+  }
+
+  memcpy(ranked[i].name, name, len + 1);
+  ranked[i].cost = cost;
+  ranked[i].uses = uses;
+  ranked[i].type = type;
+}
+
+/* Start a fuzzy search for the first 'len' characters of 'word'. Longer
+ * words tolerate more typos. The search state is allocated on first use
+ * and kept with the editor. Returns zero if there is no memory for it. */
+static uint8_t rank_start(lined_t *l, const char *word, uint8_t len) {
+  rank_t *r = (rank_t *)l->ctx;
+
+  if (!r && !(r = (rank_t *)malloc(sizeof (rank_t)))) return (0);
+
+  l->ctx = r;
+
+  fuzzy_compile(&r->fuzzy, word, len, (len < 3) ? 0 : (len < 6) ? 1 : 2);
+  r->n = 0;
+
+  return (1);
+}
+
+static void rank_complete(lined_t *l, char *buf, uint8_t head) {
+  rank_t *r = (rank_t *)l->ctx;
+  uint8_t i;
+
+  for (i=0; r && (i<r->n); i++) {
+    complete_add(l, buf, head, r->ranked[i].name, r->ranked[i].type);
+  }
+}
+
+#endif // HAVE_FUZZY
+
+#ifdef HAVE_COMPLETION
+
+/* Completion is generated in steps, so that the editor stays responsive
+ * while large directories are read or ranked. The phase and position of
+ * the generator are kept in the completion vector of the editor. */
+#define COMPLETE_START 0 // first step
+#define COMPLETE_RANK  1 // rank all commands
+#define COMPLETE_CWD   2 // rank entries of the current directory
+#define COMPLETE_SCAN  3 // match and rank entries of the argument directory
+#define COMPLETE_FUZZY 4 // only rank entries of the argument directory
+
+#define COMPLETE_STEP  512 // names looked at per step
+
 #endif
 
-#ifdef CC65
-    if (exec(*argv, NULL) != -1) return (0);
+#ifdef HAVE_DIRCACHE
+/* Open the directory of the path in the last word of the buffer, that
+ * starts at 'word'. The position of the base name is stored in 'base'. */
+static dircache_t *path_open(const char *word, const char **base) {
+  const char *slash = strrchr(word, '/');
+  char dir[LINED_LENGTH];
+  uint8_t len;
+
+  if (!slash) {
+    *base = word;
+
+    return (dircache_open("."));
+  }
+
+  *base = slash + 1;
+
+  // directory part, '/' itself for the root directory
+  len = (uint8_t)(slash - word);
+  memcpy(dir, word, len ? len : 1);
+  dir[len ? len : 1] = '\0';
+
+  return (dircache_open(dir));
+}
+
+/* Complete the last word of the buffer as a path. A complete listing is
+ * searched at once, otherwise entries are matched as they are read. Only
+ * directories are offered for cd and rmdir. */
+static uint8_t complete_path(lined_t *l, const char *c) {
+  uint8_t dirs = !strncmp(c, "cd ", 3) || !strncmp(c, "rmdir ", 6);
+  completion_t *lc = &l->lc;
+  char buf[LINED_LENGTH];
+  const char *base, *name;
+  uint8_t head, len, type;
+  uint32_t i, n;
+  dircache_t *d;
+
+  if (!(d = path_open(strrchr(c, ' ') + 1, &base))) return (0);
+
+  // everything up to the base name is kept as typed
+  head = (uint8_t)(base - l->buf);
+  memcpy(buf, l->buf, head);
+
+  len = (uint8_t)strlen(base);
+
+  if (lc->phase == COMPLETE_START) {
+    lc->phase = COMPLETE_SCAN;
+
+#ifdef HAVE_FUZZY
+    rank_start(l, base, len);
 #endif
 
-#ifdef POSIX
-    int ret = system(com);
+    if (dircache_ready(d)) {
+      for (n = dircache_find(d, base, len, &i); n > 0; n--, i++) {
+        name = dircache_name(d, i);
+        type = dircache_type(d, i);
 
-    free(com);
+        // hidden entries only, when asked for
+        if ((name[0] == '.') && (base[0] != '.')) continue;
+        if (dirs && !(type & DIRCACHE_DIR)) continue;
 
-    printf("system returned %d\n", ret);
+        complete_add(l, buf, head, name, type);
+      }
 
-    if (ret != -1) return (0);
+#ifdef HAVE_FUZZY
+      // nothing starts with the base name, try to find something close
+      if (!lc->len && len) {
+        lc->phase = COMPLETE_FUZZY;
+        return (1);
+      }
 #endif
 
-    printf("%s: command not found\n", *argv);
+      return (0);
+    }
+  }
+
+  // a listing started over since the last step is cut short
+  if (!lc->cursor) lc->tag = dircache_gen(d);
+  name = NULL;
+
+  for (n=0; (n<COMPLETE_STEP) && (lc->tag == dircache_gen(d)); n++, lc->cursor++) {
+    if (!(name = dircache_next(d, lc->cursor, &type))) break;
+
+    if ((name[0] == '.') && (base[0] != '.')) continue;
+    if (dirs && !(type & DIRCACHE_DIR)) continue;
+
+    if ((lc->phase == COMPLETE_SCAN) && !strncmp(name, base, len)) {
+      complete_add(l, buf, head, name, type);
+#ifdef HAVE_FUZZY
+    } else if (len && !lc->len) {
+      rank_name(l, name, type, 0);
+#endif
+    }
+  }
+
+  if (name) return (1);
+
+#ifdef HAVE_FUZZY
+  if (!lc->len) rank_complete(l, buf, head);
+#endif
+
+  return (0);
+}
+#endif
+
+#ifdef HAVE_FUZZY
+/* Rank commands and entries of the current directory by similarity to
+ * the first word and by usage. */
+static uint8_t complete_rank(lined_t *l) {
+  rank_t *r = (rank_t *)l->ctx;
+  completion_t *lc = &l->lc;
+  char buf[LINED_LENGTH];
+  uint16_t n;
+
+  if (lc->phase == COMPLETE_RANK) {
+    for (n=0; (n<COMPLETE_STEP) && (lc->cursor<cmdtab_size()); n++) {
+      rank_name(l, cmdtab_name(lc->cursor++), 0, 1);
+    }
+
+    if (lc->cursor < cmdtab_size()) return (1);
+
+    lc->phase  = COMPLETE_CWD;
+    lc->cursor = 0;
+  }
+
+#ifdef HAVE_DIRCACHE
+  {
+    dircache_t *d = dircache_open(".");
+    const char *name = NULL;
+    uint8_t type;
+
+    if (d && !lc->cursor) lc->tag = dircache_gen(d);
+
+    for (n=0; d && (n<COMPLETE_STEP) && (lc->tag == dircache_gen(d)); n++, lc->cursor++) {
+      if (!(name = dircache_next(d, lc->cursor, &type))) break;
+
+      if ((name[0] == '.') && (r->fuzzy.pattern[0] != '.')) continue;
+
+      rank_name(l, name, type, 0);
+    }
+
+    if (name) return (1);
   }
+#endif
+
+  rank_complete(l, buf, 0);
 
   return (0);
 }
+#endif
+
+#ifdef HAVE_COMPLETION
+/* Generate the candidates for the buffer content, one step at a time.
+ * Returns non zero, as long as there are more steps to do. */
+static uint8_t cli_complete(lined_t *l) {
+  const char *c = l->buf;
+  uint16_t i, n;
+  uint8_t len;
+
+  // remove all the leading spaces
+  while (c && (*c == ' ')) c++;
+
+  // TAB completion requires at least one character
+  if ((len = strlen(c)) < 1) return (0);
+
+#ifdef HAVE_DIRCACHE
+  // arguments are completed as paths
+  if (strchr(c, ' ')) {
+    return (complete_path(l, c));
+  }
+#endif
+
+#ifdef HAVE_FUZZY
+  if (l->lc.phase != COMPLETE_START) {
+    return (complete_rank(l));
+  }
+#endif
+
+  if (!strncmp(c, "echo", 4)) {
+    lined_completion_add(l, "echo foo bar");
+  }
+
+  // builtins and executables starting with the buffer content
+  cmdtab_update(0);
+
+  for (n = cmdtab_find(c, len, &i); n > 0; n--) {
+    lined_completion_add(l, cmdtab_name(i++));
+  }
+
+#ifdef HAVE_FUZZY
+  // nothing starts with the buffer content, look for something close
+  if (!l->lc.len && rank_start(l, c, len)) {
+    usage_build(l);
+
+    l->lc.phase = COMPLETE_RANK;
+
+    return (1);
+  }
+#endif
+
+  return (0);
+}
+#endif
+
+#ifdef HAVE_HINTS
+#define HINT_BUCKETS 32 // power of two, at least twice the number of hints
+#define HINT_WORD    12 // longest command name with a hint, plus one
+
+/* Hints for the arguments of the builtins. The arguments are separated
+ * by spaces, a [...] group counts as one. */
+typedef struct hint_t {
+  const char *name;
+  const char *args;
+} hint_t;
+
+static const hint_t hints[] = {
+  { "cd",       "<path>"                },
+  { "mv",       "<old> <new>"           },
+  { "rm",       "<name>"                },
+  { "mkdir",    "<dir>"                 },
+  { "rmdir",    "<dir>"                 },
+  { "realpath", "<path>"                },
+  { "basename", "<path>"                },
+  { "dirname",  "<path>"                },
+  { "mount",    "[<dir>] [<dev>]"       },
+  { "parse",    "[<arg1> <arg2> ...]"   },
+  { "echo",     "[<text1> <text2> ...]" },
+  { "cat",      "[<file1> <file2> ...]" },
+  { "export",   "[<name>[=<value>] ...]" },
+  { "unset",    "<name> [<name> ...]"   },
+  { "source",   "<file> [<arg1> <arg2> ...]" },
+  { "sleep",    "<sec>"                 }
+};
+
+#define HINTS (sizeof(hints) / sizeof(*hints))
+
+static uint8_t hint_bucket[HINT_BUCKETS]; // index into hints plus one
+
+static uint8_t hint_hash(const char *s, uint8_t len) {
+  uint16_t h = 5381;
+
+  while (len--) h = (h << 5) + h + (uint8_t)*s++;
+
+  return ((uint8_t)h & (HINT_BUCKETS - 1));
+}
+
+/* Index the hints by the hash of their name, using linear probing. */
+static void hint_init(void) {
+  uint8_t i, b;
+
+  // cli_init() runs again on reset
+  memset(hint_bucket, 0, sizeof (hint_bucket));
+
+  for (i=0; i<HINTS; i++) {
+    b = hint_hash(hints[i].name, (uint8_t)strlen(hints[i].name));
+
+    while (hint_bucket[b]) b = (b + 1) & (HINT_BUCKETS - 1);
+
+    hint_bucket[b] = i + 1;
+  }
+}
+
+static const hint_t *hint_find(const char *word, uint8_t len) {
+  uint8_t b = hint_hash(word, len);
+  const hint_t *h;
+
+  while (hint_bucket[b]) {
+    h = &hints[hint_bucket[b] - 1];
+
+    if (!strncmp(h->name, word, len) && !h->name[len]) return (h);
+
+    b = (b + 1) & (HINT_BUCKETS - 1);
+  }
+
+  return (NULL);
+}
+
+/* Skip 'n' arguments of a hint, returns NULL if there are none left. */
+static const char *hint_skip(const char *args, uint8_t n) {
+  uint8_t depth = 0;
+
+  for (; *args && n; args++) {
+    if (*args == '[') depth++;
+    if (*args == ']') depth--;
+
+    if ((*args == ' ') && !depth) n--;
+  }
+
+  return (*args ? args : NULL);
+}
+
+/* Hint for the arguments following the ones already typed. A partially
+ * typed argument counts as typed, so the hint moves on with the input.
+ * It keeps no state between calls, so any number of editors can use it. */
+static const char *cli_hint(lined_t *l) {
+  const char *c = l->buf, *w;
+  uint8_t len, n = 0, quote = 0;
+  const hint_t *h;
+
+  // remove all the leading spaces
+  while (*c == ' ') c++;
+
+  for (w=c; *c && (*c != ' '); c++);
+  len = (uint8_t)(c - w);
+
+  if (!len || (len >= HINT_WORD)) return (NULL);
+
+  if (!(h = hint_find(w, len))) return (NULL);
+
+  // count the arguments, quoted spaces don't separate them
+  for (; *c; c++) {
+    if (!quote && (c[-1] == ' ') && (*c != ' ')) n++;
+    if (*c == '"') quote ^= 1;
+  }
+
+  return (hint_skip(h->args, n));
+}
+#endif
+
+#ifdef HAVE_HIGHLIGHT
+/* Returns non-zero if the first 'len' characters of 'name' are a command
+ * we can run, either a builtin, a program in PATH or a path to one. */
+static uint8_t cli_command(lined_t *l, const char *name, uint8_t len) {
+  (void)l;
+
+#ifdef POSIX
+  if (memchr(name, '/', len)) {
+    char path[LINED_LENGTH];
+
+    memcpy(path, name, len);
+    path[len] = 0;
+
+    return (!access(path, X_OK));
+  }
+#endif
+
+#ifdef HAVE_COMPLETION
+  return (cmdtab_exists(name, len));
+#else
+  return (1);
+#endif
+}
+
+/* Returns the generation of the command index, after picking up a new
+ * PATH or new programs in it. */
+static uint32_t cli_commands(lined_t *l) {
+  (void)l;
+
+#ifdef HAVE_COMPLETION
+  cmdtab_update(0);
+
+  return (cmdtab_gen());
+#else
+  return (0);
+#endif
+}
+#endif
+
+/* The callbacks of editors running the shell. */
+const lined_cb_t cli_cb = {
+#ifdef HAVE_COMPLETION
+  cli_complete,
+#else
+  NULL,
+#endif
+#ifdef HAVE_HINTS
+  cli_hint,
+#else
+  NULL,
+#endif
+#ifdef HAVE_HIGHLIGHT
+  cli_command,
+  cli_commands
+#else
+  NULL,
+  NULL
+#endif
+};
+
+void cli_init(void) {
+#ifdef HAVE_VARS
+  parse_expand(var_lookup);
+#endif
+#ifdef HAVE_GLOB
+  parse_glob(glob_expand);
+#endif
+#ifdef HAVE_ARITH
+  parse_arith(arith_eval);
+#endif
+#ifdef HAVE_HINTS
+  hint_init();
+#endif
+#ifdef HAVE_COMPLETION
+  cmdtab_init(commands);
+#endif
+}
+
+void cli_fini(void) {
+#ifdef HAVE_COMPLETION
+  cmdtab_fini();
+#endif
+#ifdef HAVE_DIRCACHE
+  dircache_fini();
+#endif
+#ifdef HAVE_CMDCACHE
+  cmdcache_fini();
+#endif
+#ifdef HAVE_SCRIPT
+  script_fini();
+#endif
+#ifdef HAVE_GLOB
+  parse_glob(NULL);
+#endif
+#ifdef HAVE_ARITH
+  parse_arith(NULL);
+  arith_fini();
+#endif
+#ifdef HAVE_VARS
+  parse_expand(NULL);
+#endif
+}
+
+/* Free what the callbacks keep in the context of editor 'l'. */
+void cli_release(lined_t *l) {
+  free(l->ctx);
+  l->ctx = NULL;
+}
+
+#ifdef HAVE_FUZZY
+
+#define SUGGEST_MAX 3 // number of corrections offered
+
+/* Keywords and builtins of sh, that no command in PATH stands for. */
+static const char *const shell_words[] = {
+  "!", ".", ":", "[", "[[", "{", "alias", "case", "command", "eval", "exec",
+  "export", "for", "if", "local", "read", "readonly", "return", "set",
+  "shift", "source", "trap", "type", "ulimit", "umask", "unalias", "unset",
+  "until", "wait", "while", NULL
+};
+
+/* Returns non-zero, if the shell runs 'name' itself: a keyword, a builtin,
+ * an assignment or a subshell. */
+static uint8_t shell_word(const char *name) {
+  const char *const *w;
+
+  if (strpbrk(name, "=(")) return (1);
+
+  for (w = shell_words; *w; w++) {
+    if (!strcmp(*w, name)) return (1);
+  }
+
+  return (0);
+}
+
+/* Report the unknown command 'name' with the closest known commands, by
+ * edit distance. Names that can't be close enough are skipped by their
+ * length and characters, before computing the distance. */
+static void command_suggest(const char *name) {
+  const char *best[SUGGEST_MAX];
+  uint8_t dist[SUGGEST_MAX];
+  size_t len = strlen(name);
+  uint8_t bound, n = 0, i, d;
+  uint16_t c = 0;
+  uint32_t sig;
+  fuzzy_t f;
+
+  printf("%s: command not found\n", name);
+
+  if (!len || (len > FUZZY_MAX)) return;
+
+  bound = (len < 3) ? 0 : (len < 6) ? 1 : 2;
+  sig   = cmdtab_sig(name, len);
+
+  if (!bound) return;
+
+  fuzzy_compile(&f, name, len, bound);
+
+  for (; cmdtab_near(sig, len, bound, &c); c++) {
+    const char *cand = cmdtab_name(c);
+
+    if ((d = fuzzy_distance(&f, cand, 0)) > bound) continue;
+
+    // keep the closest ones, in table order among equals
+    for (i = n; (i > 0) && (dist[i - 1] > d); i--) {
+      if (i < SUGGEST_MAX) {
+        best[i] = best[i - 1];
+        dist[i] = dist[i - 1];
+      }
+    }
+
+    if (i < SUGGEST_MAX) {
+      best[i] = cand;
+      dist[i] = d;
+      if (n < SUGGEST_MAX) n++;
+    }
+  }
+
+  for (i=0; i<n; i++) {
+    printf("%s%s", i ? ", " : "did you mean: ", best[i]);
+  }
+
+  if (n) printf("?\n");
+}
+
+#endif // HAVE_FUZZY
+
+#ifdef HAVE_EXEC
+
+/* A command of a pipeline. */
+typedef struct stage_t {
+  char  **argv; /* Arguments, NULL terminated. */
+  uint8_t argc; /* Number of arguments. */
+  uint8_t cmd;  /* Builtin, or BUILTIN_NONE. */
+  int     in;   /* Standard input. */
+  int     out;  /* Standard output. */
+  int     err;  /* Standard error. */
+  pid_t   pid;  /* Process of an external command, or -1. */
+  uint8_t ret;  /* Status of a builtin run in push. */
+} stage_t;
+
+static void stage_close(stage_t *s) {
+  if (s->in > 2)  close(s->in);
+  if (s->out > 2) close(s->out);
+  if (s->err > 2) close(s->err);
+
+  s->in  = 0;
+  s->out = 1;
+  s->err = 2;
+}
+
+/* Open 'path' for redirection 'op' of stage 's'. A later redirection of
+ * the same stream replaces an earlier one. Returns 0 on failure. */
+static uint8_t stage_redirect(stage_t *s, uint8_t op, const char *path) {
+  int flags, fd, *std;
+
+  switch (op) {
+    case PARSE_OP_IN:
+      flags = O_RDONLY;                       std = &s->in;  break;
+    case PARSE_OP_OUT:
+      flags = O_WRONLY | O_CREAT | O_TRUNC;   std = &s->out; break;
+    case PARSE_OP_APPEND:
+      flags = O_WRONLY | O_CREAT | O_APPEND;  std = &s->out; break;
+    case PARSE_OP_ERR:
+      flags = O_WRONLY | O_CREAT | O_TRUNC;   std = &s->err; break;
+    default:
+      flags = O_WRONLY | O_CREAT | O_APPEND;  std = &s->err; break;
+  }
+
+  if ((fd = open(path, flags | O_CLOEXEC, 0666)) < 0) {
+    perror(path);
+    return (0);
+  }
+
+  if (*std > 2) close(*std);
+  *std = fd;
+
+  return (1);
+}
+
+/* Run builtin 'cmd' in push itself, with its standard streams moved to
+ * the ones of the stage. Returns its status. */
+static uint8_t stage_builtin(stage_t *s) {
+  void (*sigpipe)(int);
+  int std[3], i, con;
+  uint8_t ret;
+
+  if (!builtins[s->cmd].run) return (0);
+
+  fflush(stdout);
+
+  for (i=0; i<3; i++) std[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+
+  dup2(s->in, 0);
+  dup2(s->out, 1);
+  dup2(s->err, 2);
+
+  // a reader that is gone ends the output, not push
+  sigpipe = signal(SIGPIPE, SIG_IGN);
+
+  // conio output goes to the stage too, not to a session socket
+  con = posix_console_fd(-1);
+
+  ret = builtins[s->cmd].run(s->argc, s->argv);
+  fflush(stdout);
+
+  posix_console_fd(con);
+
+  signal(SIGPIPE, sigpipe);
+
+  for (i=0; i<3; i++) {
+    dup2(std[i], i);
+    close(std[i]);
+  }
+
+  return (ret);
+}
+
+/* Run stage 'j' of the 'n' stages 's', a builtin, in a child process. It
+ * runs alongside the other stages then, so it can't block them on a full
+ * pipe, and it only changes the state of the child, like in a subshell.
+ * Returns the process id, or -1. */
+static pid_t stage_fork(stage_t *s, uint8_t n, uint8_t j) {
+  pid_t pid;
+  uint8_t k;
+
+  fflush(stdout);
+
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    return (-1);
+  }
+
+  if (!pid) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+
+    // the pipe ends of the other stages would hold them open
+    for (k=0; k<n; k++) {
+      if (k != j) stage_close(&s[k]);
+    }
+
+    _exit(stage_builtin(&s[j]));
+  }
+
+  return (pid);
+}
+
+/* Run the commands in 'argv', which are separated by pipe operators and
+ * may have redirections. The first command resolved to 'path', if that
+ * is known. All commands are started at once, connected by pipes, the
+ * builtins of a pipeline in a child process each. A single builtin with
+ * redirections runs inside push. */
+static void pipeline_run(uint8_t argc, char **argv, parse_arena_t *a, const char *path) {
+  const char *first = argv[0];
+  uint8_t n = 1, i, j, op;
+  stage_t *s;
+  int fd[2];
+
+  for (i=0; i<argc; i++) {
+    if (parse_op(argv[i]) == PARSE_OP_PIPE) n++;
+  }
+
+  if (!(s = (stage_t *)parse_arena_alloc(a, n * sizeof (stage_t)))) return;
+
+  for (j=0; j<n; j++) {
+    s[j].in  = 0;
+    s[j].out = 1;
+    s[j].err = 2;
+    s[j].pid = -1;
+    s[j].ret = 0;
+  }
+
+  // split up the commands, taking their redirections out
+  for (i=j=0; j<n; j++, i++) {
+    s[j].argv = argv + i;
+    s[j].argc = 0;
+
+    for (; (i < argc) && ((op = parse_op(argv[i])) != PARSE_OP_PIPE); i++) {
+      if (op == PARSE_OP_NONE) {
+        s[j].argv[s[j].argc++] = argv[i];
+        continue;
+      }
+
+      if ((i + 1 == argc) || (parse_op(argv[i + 1]) != PARSE_OP_NONE)) {
+        printf("syntax error near '%s'\n", parse_ops[op]);
+        goto fail;
+      }
+
+      if (!stage_redirect(&s[j], op, argv[++i])) goto fail;
+    }
+
+    s[j].argv[s[j].argc] = NULL;
+
+    // a lone redirection only creates its file
+    if (!s[j].argc && (n > 1)) {
+      printf("syntax error near '|'\n");
+      goto fail;
+    }
+
+    s[j].cmd = s[j].argc ? builtin_find(*s[j].argv) : BUILTIN_NONE;
+  }
+
+  for (j=0; j+1<n; j++) {
+    if (pipe(fd)) {
+      perror("pipe");
+      goto fail;
+    }
+
+    // only the command they are passed to gets them
+    fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+
+    // redirections take precedence over the pipe
+    if (s[j].out == 1) s[j].out = fd[1]; else close(fd[1]);
+    if (s[j+1].in == 0) s[j+1].in = fd[0]; else close(fd[0]);
+  }
+
+  exec_begin();
+
+  for (j=0; j<n; j++) {
+    if (!s[j].argc) continue;
+
+    if (s[j].cmd == BUILTIN_NONE) {
+      s[j].pid = exec_spawn(s[j].argv, (!j && (*s[j].argv == first)) ? path : NULL,
+                            s[j].in, s[j].out, s[j].err);
+    } else if (n > 1) {
+      // without a child, it runs in push after all
+      if ((s[j].pid = stage_fork(s, n, j)) < 0) continue;
+    } else {
+      continue;
+    }
+
+    stage_close(&s[j]);
+  }
+
+  for (j=0; j<n; j++) {
+    if ((s[j].cmd == BUILTIN_NONE) || (s[j].pid > 0)) continue;
+
+    s[j].ret = stage_builtin(&s[j]);
+    stage_close(&s[j]);
+  }
+
+  for (j=0; j<n; j++) {
+    stage_close(&s[j]);
+
+    if (s[j].pid > 0) {
+      int ret = exec_wait(s[j].pid);
+
+      // the pipeline's status is the one of its last command
+      if (j == n - 1) status = exec_status(ret);
+    } else {
+      status = ((s[j].cmd == BUILTIN_NONE) && s[j].argc) ? 127 : s[j].ret;
+    }
+  }
+
+  exec_end();
+
+  return;
+
+fail:
+  for (j=0; j<n; j++) stage_close(&s[j]);
+}
+
+#endif // HAVE_EXEC
+
+#ifdef HAVE_SERVER
+/* Hook of the server, to run lines that leave the state of the shell
+ * alone in a child process. Returns the process id, 0 in the child, or
+ * -1 to run the line in place after all. */
+pid_t (*cli_detach)(void) = NULL;
+
+/* Returns non-zero, if command 'argv' changes the state of the shell, so
+ * it has to run in push itself: a builtin like cd or export, a variable
+ * assignment or a cd shortcut. Pipelines never do. */
+static uint8_t command_inplace(uint8_t argc, char **argv, uint8_t cmd) {
+  uint8_t i;
+
+  for (i=0; i<argc; i++) {
+    if (parse_op(argv[i]) == PARSE_OP_PIPE) return (0);
+  }
+
+  if (cmd != BUILTIN_NONE) return (builtin_state(cmd));
+
+  return (((argc == 1) && strchr(*argv, '=')) ||
+          !strcmp(*argv, "..") || !strcmp(*argv, "/"));
+}
+#endif
+
+/* Run builtin 'cmd', or the external command 'argv[0]', that resolved to
+ * 'path' if that's known. Returns 3, if the server runs it in a child. */
+static uint8_t command_run(lined_t *l, uint8_t argc, char **argv, parse_arena_t *a,
+                           uint8_t cmd, const char *path) {
+  uint8_t i;
+
+#ifdef HAVE_SERVER
+  // lines entered in a session, that leave the shell alone, don't hold
+  // up the other sessions
+  if (l && cli_detach && !command_inplace(argc, argv, cmd)) {
+    pid_t pid = cli_detach();
+
+    if (pid > 0) return (3);
+
+    if (!pid) {
+      cli_detach = NULL;
+      command_run(NULL, argc, argv, a, cmd, path);
+      fflush(stdout);
+      _exit(status);
+    }
+  }
+#endif
+
+  for (i=0; i<argc; i++) {
+    if (parse_op(argv[i]) == PARSE_OP_NONE) continue;
+
+#ifdef HAVE_EXEC
+    pipeline_run(argc, argv, a, path);
+#else
+    printf("pipes and redirections not supported\n");
+#endif
+    return (0);
+  }
+
+  if ((cmd == BUILTIN_EXIT) || (cmd == BUILTIN_LOGOUT)) {
+    return (1); // exit
+  } else if (cmd == BUILTIN_RESET) {
+    return (2); // reset
+  } else if (cmd == BUILTIN_TEST) {
+    if (l) term_push_keys(l, input);
+  } else if (cmd != BUILTIN_NONE) {
+#ifdef HAVE_EXEC
+    // cat without files reads the terminal, which gets its initial mode
+    uint8_t tty = (builtins[cmd].run == cmd_cat) && (argc == 1);
+
+    if (tty) exec_begin();
+#endif
+
+    i = builtins[cmd].run(argc, argv);
+
+#ifdef HAVE_EXEC
+    if (tty) exec_end();
+
+    status = i;
+#endif
+  } else {
+#ifdef HAVE_VARS
+    if ((argc == 1) && (i = var_name(*argv)) && (argv[0][i] == '=')) {
+      var_set(*argv, i, *argv + i + 1, 0);
+#ifdef HAVE_EXEC
+      status = 0;
+#endif
+      return (0);
+    }
+#endif
+
+#ifdef HAVE_SCRIPT
+    if (script_call(argc, argv, &i)) return (i);
+#endif
+
+#if !defined(KICKC) && !defined(OSCAR64)
+    if (!strcmp(*argv, ".")) {
+      char *args[] = { "ls", "-la", NULL };
+      cli_set_status(cmd_ls(2, args)); return (0);
+    } else if (!strcmp(*argv, "..")) {
+      char *args[] = { "cd", "..", NULL };
+      cli_set_status(cmd_cd(2, args)); return (0);
+    } else if (!strcmp(*argv, "/")) {
+      char *args[] = { "cd", "/", NULL };
+      cli_set_status(cmd_cd(2, args)); return (0);
+    }
+#endif
+
+#ifdef CC65
+    if (exec(*argv, NULL) != -1) return (0);
+#endif
+
+#ifdef HAVE_FUZZY
+    // unknown names without a path are caught before trying to start them
+    if (!path) cmdtab_update(1);
+
+    if (!path && !strchr(*argv, '/') && !shell_word(*argv) &&
+        !cmdtab_exists(*argv, strlen(*argv))) {
+      command_suggest(*argv);
+#ifdef HAVE_EXEC
+      status = 127;
+#endif
+      return (0);
+    }
+#endif
+
+#ifdef HAVE_EXEC
+    {
+      pid_t pid;
+
+      exec_begin();
+
+      pid = exec_spawn(argv, path, 0, 1, 2);
+      status = (pid > 0) ? exec_status(exec_wait(pid)) : 127;
+
+      exec_end();
+
+      return (0);
+    }
+#endif
+
+    printf("%s: command not found\n", *argv);
+  }
+
+  return (0);
+}
+
+#ifdef HAVE_EXEC
+/* Run the command line 'line', that parse_shell() found to be in syntax
+ * push doesn't know, with sh. */
+static uint8_t shell_run(lined_t *l, const char *line) {
+  char *argv[] = { "sh", "-c", NULL, NULL };
+
+  argv[2] = (char *)line;
+
+  return (command_run(l, 3, argv, NULL, BUILTIN_NONE, NULL));
+}
+
+/* Run the command line 'line' of a script with sh. Returns what cli_run()
+ * does. */
+uint8_t cli_shell(const char *line) {
+  return (shell_run(NULL, line));
+}
+#endif
+
+/* Returns the index of builtin 'name', for cli_run(). */
+uint8_t cli_builtin(const char *name) {
+  return (builtin_find(name));
+}
+
+/* Run the command 'argv', that was split by a script, with arena 'a' for
+ * pipelines. 'cmd' is the builtin returned by cli_builtin(). Returns 1 to
+ * log out, 2 to reset, 0 otherwise. */
+uint8_t cli_run(uint8_t argc, char **argv, parse_arena_t *a, uint8_t cmd) {
+  return (command_run(NULL, argc, argv, a, cmd, NULL));
+}
+
+/* Returns the exit status of the last command. */
+uint8_t cli_status(void) {
+#ifdef HAVE_EXEC
+  return (status);
+#else
+  return (0);
+#endif
+}
+
+void cli_set_status(uint8_t code) {
+#ifdef HAVE_EXEC
+  status = code;
+#endif
+}
+
+/* Run the command line 'cmd', which is split up in place. Arguments live
+ * in an arena on the stack, that only spills to the heap for very long
+ * command lines. Lines run before are taken from the command cache, already
+ * split and resolved. Returns 1 to log out, 2 to reset, 3 while the line
+ * runs in a child of the server, 0 otherwise. */
+uint8_t cli_exec(lined_t *l, char *cmd) {
+  char *space[PARSE_ARGS];
+  parse_arena_t arena;
+  uint8_t argc = 0, ret = 0, i;
+  const char *path = NULL;
+  char **argv;
+
+#ifdef HAVE_CMDCACHE
+  const cmdcache_t *c;
+  char *line, exe[CMDCACHE_PATH];
+  uint16_t len;
+  uint32_t hash = cmdcache_hash(cmd, &len);
+#endif
+
+  parse_arena_init(&arena, space, sizeof (space));
+
+#ifdef HAVE_CMDCACHE
+  if ((c = cmdcache_find(cmd, len, hash)) &&
+      (argv = (char **)parse_arena_alloc(&arena, (c->argc + 1) * sizeof (char *)))) {
+    memcpy(cmd, c->split, len + 1);
+
+    for (i=0; i<c->argc; i++) {
+      if ((c->word[i] & CMDCACHE_OP) == CMDCACHE_OP) {
+        argv[i] = (char *)parse_ops[c->word[i] & ~CMDCACHE_OP];
+      } else {
+        argv[i] = cmd + c->word[i];
+      }
+    }
+    argv[i] = NULL;
+
+    ret = command_run(l, c->argc, argv, &arena, c->cmd, c->path);
+
+    parse_arena_free(&arena);
+
+    return (ret);
+  }
+#endif
+
+#ifdef HAVE_EXEC
+  // lists, substitutions and the like are left to sh, they are never
+  // cached
+  if (parse_shell(cmd)) {
+    parse_arena_free(&arena);
+
+    return (shell_run(l, cmd));
+  }
+#endif
+
+#ifdef HAVE_CMDCACHE
+  // keep the line as entered, for the cache
+  if ((line = (char *)parse_arena_alloc(&arena, len + 1))) {
+    memcpy(line, cmd, len + 1);
+  }
+#endif
+
+  if ((argv = parse_args(cmd, &arena, &argc)) && argc) {
+    i = builtin_find(*argv);
+
+#ifdef HAVE_CMDCACHE
+    if (i == BUILTIN_NONE) {
+      cmdtab_update(1);
+
+      if (cmdtab_which(*argv, exe, sizeof (exe))) path = exe;
+    }
+
+    // expansions depend on variables and files, those lines are parsed
+    // every time
+    if (line && ((i != BUILTIN_NONE) || path) && !strpbrk(line, "$~*?[")) {
+      cmdcache_add(line, len, hash, cmd, argc, argv, i, path);
+    }
+#endif
+
+    ret = command_run(l, argc, argv, &arena, i, path);
+  } else if (!argv && (argc == 255)) {
+    printf("argument list too long\n");
+  }
+
+  parse_arena_free(&arena);
+
+  return (ret);
+}
+
+/* Get editor 'l' ready for the next line, once the entered one is done. */
+void cli_next(lined_t *l) {
+  lined_reset(l, l->flags | LINED_ECHO);
+}
+
+/* Run the line entered in editor 'l'. Returns what cli_exec() does, the
+ * editor is left to cli_next(), so that the server can add the output
+ * collected from the line first. */
+uint8_t cli_enter(lined_t *l) {
+  lined_edit(l, TERM_KEY_ENTER);
+
+  printf("\n");
+
+#ifdef HAVE_SHARED_HISTORY
+  histfile_append(l->buf);
+#endif
+
+  return (cli_exec(l, l->buf));
+}
+
+/* Feed 'key' to the editor 'l' and run the line, when it is entered.
+ * Returns 1 to log out, 2 to reset, 3 while the line runs in a child of
+ * the server, which calls cli_next() when it is done, 0 otherwise. */
+uint8_t cli_input(lined_t *l, uint8_t key) {
+  uint8_t ret = 0;
+
+#ifdef HAVE_SHARED_HISTORY
+  // pick up commands of other sessions, before browsing the history
+  if ((key == TERM_KEY_CTRL_P) && (l->hist == LINED_HISTORY_NONE)) {
+    histfile_sync();
+  }
+#endif
+
+  if (key == TERM_KEY_ENTER) {
+    ret = cli_enter(l);
+
+    if (ret != 3) cli_next(l);
+
+    return (ret);
+  }
+
+  lined_edit(l, key);
+
+  if (key == TERM_KEY_CTRL_C) {
+    printf("break\n");
+    ret = 1;
+  } else if (key == TERM_KEY_CTRL_D) {
+    printf("exit\n");
+    ret = 1;
+  }
+
+  return (ret);
+}
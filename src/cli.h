@@ -1,6 +1,34 @@
 #ifndef _CLI_H_
 #define _CLI_H_
 
-uint8_t cli_exec(char *cmd);
+#include <stdint.h>
+
+#ifdef HAVE_SERVER
+#include <sys/types.h>
+#endif
+
+#include "lined.h"
+#include "parse.h"
+
+extern const lined_cb_t cli_cb;
+
+#ifdef HAVE_SERVER
+extern pid_t (*cli_detach)(void);
+#endif
+
+void    cli_init(void);
+void    cli_fini(void);
+void    cli_release(lined_t *l);
+
+uint8_t cli_exec(lined_t *l, char *cmd);
+uint8_t cli_input(lined_t *l, uint8_t key);
+uint8_t cli_enter(lined_t *l);
+void    cli_next(lined_t *l);
+
+uint8_t cli_builtin(const char *name);
+uint8_t cli_run(uint8_t argc, char **argv, parse_arena_t *a, uint8_t cmd);
+uint8_t cli_shell(const char *line);
+uint8_t cli_status(void);
+void    cli_set_status(uint8_t code);
 
 #endif // _CLI_H_
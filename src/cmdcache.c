@@ -0,0 +1,145 @@
+/* cmdcache.c -- cache of parsed command lines.
+ *
+ * The same few lines are run again and again from the history. For each
+ * of the most recently run lines, the cache keeps the line split into its
+ * words, along with the command the first word resolved to: a builtin or
+ * the path of an executable. A line that hits the cache is restored with
+ * a single copy, skipping the lexer, the builtin lookup and the PATH search.
+ *
+ * Lines are located by a hash of their text, and compared in full. The
+ * cache is flushed when PATH changes, an executable that is gone drops its
+ * entry.
+ */
+
+#ifdef HAVE_CMDCACHE
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "cmdcache.h"
+
+#define CMDCACHE_SLOTS 16 // number of cached lines
+
+static cmdcache_t cache[CMDCACHE_SLOTS];
+static uint32_t   tick = 0;
+static char      *path = NULL; // PATH the entries were resolved with
+
+/* Hash function (FNV-1a) of 'line', its length is stored in 'len'. */
+uint32_t cmdcache_hash(const char *line, uint16_t *len) {
+  const char *s = line;
+  uint32_t h = 2166136261u;
+
+  while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+
+  *len = s - line;
+
+  return (h);
+}
+
+static void cache_drop(cmdcache_t *c) {
+  free(c->word);
+  memset(c, 0, sizeof (cmdcache_t));
+}
+
+static void cache_flush(void) {
+  uint8_t i;
+
+  for (i=0; i<CMDCACHE_SLOTS; i++) cache_drop(&cache[i]);
+}
+
+/* Returns the entry of 'line', of length 'len' and hash value 'hash', or
+ * NULL if it isn't cached. */
+const cmdcache_t *cmdcache_find(const char *line, uint16_t len, uint32_t hash) {
+  const char *env = getenv("PATH");
+  uint8_t i;
+
+  if (!env) env = "";
+
+  if (!path || strcmp(path, env)) {
+    cache_flush();
+
+    free(path);
+    path = strdup(env);
+
+    return (NULL);
+  }
+
+  for (i=0; i<CMDCACHE_SLOTS; i++) {
+    cmdcache_t *c = &cache[i];
+
+    if (!c->word || (c->hash != hash) || (c->len != len)) continue;
+    if (memcmp(c->line, line, len)) continue;
+
+    if (c->path && access(c->path, X_OK)) {
+      cache_drop(c);
+      return (NULL);
+    }
+
+    c->tick = ++tick;
+
+    return (c);
+  }
+
+  return (NULL);
+}
+
+/* Cache 'line', its 'split' form with the words in 'argv' pointing into
+ * it, and the command 'cmd' with its executable 'path' (if any). All of
+ * them are copied into a single allocation, that replaces the least
+ * recently used entry. */
+void cmdcache_add(const char *line, uint16_t len, uint32_t hash,
+                  const char *split, uint8_t argc, char **argv,
+                  uint8_t cmd, const char *exe) {
+  size_t words = argc * sizeof (uint16_t), size = 2 * (len + 1);
+  cmdcache_t *c = &cache[0];
+  uint8_t i;
+  char *p;
+
+  if (!path) return;
+
+  for (i=1; i<CMDCACHE_SLOTS; i++) {
+    if (cache[i].tick < c->tick) c = &cache[i];
+  }
+
+  cache_drop(c);
+
+  if (exe) size += strlen(exe) + 1;
+
+  if (!(c->word = (uint16_t *)malloc(words + size))) return;
+
+  for (i=0; i<argc; i++) {
+    uint8_t op = parse_op(argv[i]);
+
+    c->word[i] = (op == PARSE_OP_NONE) ? argv[i] - split : CMDCACHE_OP | op;
+  }
+
+  p = (char *)c->word + words;
+
+  c->line = p;
+  memcpy(p, line, len + 1);
+  p += len + 1;
+
+  c->split = p;
+  memcpy(p, split, len + 1);
+  p += len + 1;
+
+  c->path = exe ? strcpy(p, exe) : NULL;
+
+  c->hash = hash;
+  c->tick = ++tick;
+  c->len  = len;
+  c->argc = argc;
+  c->cmd  = cmd;
+}
+
+void cmdcache_fini(void) {
+  cache_flush();
+
+  free(path);
+  path = NULL;
+}
+
+#endif // HAVE_CMDCACHE
@@ -0,0 +1,29 @@
+#ifndef _CMDCACHE_H_
+#define _CMDCACHE_H_
+
+#include <stdint.h>
+
+#define CMDCACHE_PATH 256    // max length of an executable path
+#define CMDCACHE_OP   0xff00 // word offset of an operator, or'ed with it
+
+typedef struct cmdcache_t {
+  uint32_t  hash;  /* Hash of the line. */
+  uint32_t  tick;  /* Last use, for LRU replacement. */
+  uint16_t  len;   /* Length of the line. */
+  uint8_t   argc;  /* Number of words. */
+  uint8_t   cmd;   /* Command the first word resolved to. */
+  uint16_t *word;  /* Offsets of the words in 'split', or operators. */
+  char     *line;  /* The line as entered. */
+  char     *split; /* The line split into terminated, unquoted words. */
+  char     *path;  /* Executable of an external command, or NULL. */
+} cmdcache_t;
+
+uint32_t          cmdcache_hash(const char *line, uint16_t *len);
+const cmdcache_t *cmdcache_find(const char *line, uint16_t len, uint32_t hash);
+
+void              cmdcache_add(const char *line, uint16_t len, uint32_t hash,
+                               const char *split, uint8_t argc, char **argv,
+                               uint8_t cmd, const char *path);
+void              cmdcache_fini(void);
+
+#endif // _CMDCACHE_H_
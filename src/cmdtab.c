@@ -0,0 +1,412 @@
+/* cmdtab.c -- sorted index of command names.
+ *
+ * The index holds the builtin commands and, on POSIX, every executable
+ * found in the directories of PATH. Names are kept sorted, so all names
+ * starting with a given prefix form a single run, that is located with a
+ * binary search. The PATH part is rebuilt when PATH or the modification
+ * time of one of its directories changes. While completing, the
+ * directories are looked at no more than once every CMDTAB_RESCAN
+ * seconds.
+ *
+ * With fuzzy matching, every name also keeps its length and a signature
+ * of the characters it contains, so that names too far off to be worth
+ * an edit distance computation are skipped with two compares.
+ */
+
+#ifdef HAVE_COMPLETION
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef HAVE_FUZZY
+#include <ctype.h>
+#endif
+
+#ifdef POSIX
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "cmdtab.h"
+
+typedef struct cmdtab_t {
+  const char *name; /* Command name. */
+  uint8_t     dir;  /* Index of the PATH directory, 0 for builtins. */
+#ifdef HAVE_FUZZY
+  uint8_t     len;  /* Name length, up to 255. */
+  uint32_t    sig;  /* Characters contained, see cmdtab_sig(). */
+#endif
+} cmdtab_t;
+
+static const char *builtin = NULL;
+static cmdtab_t   *table = NULL;
+static uint16_t    table_len = 0;
+static uint16_t    table_max = 0;
+static uint32_t    gen = 0; // number of builds
+
+#ifdef POSIX
+
+#define CMDTAB_BLOCK 4096 // size of a name arena block
+#define CMDTAB_DIRS  32   // max number of PATH directories
+#define CMDTAB_RESCAN 2   // seconds between unforced PATH scans
+
+static char  *path = NULL;             // PATH the index was built from
+static time_t mtime[CMDTAB_DIRS];      // modification times of PATH dirs
+static char  *dirs[CMDTAB_DIRS];       // PATH dirs, pointing into 'path'
+static uint8_t ndirs = 0;
+static time_t  scanned = 0;            // time of the last PATH scan
+
+static char  *block = NULL;            // current arena block
+static size_t block_left = 0;          // bytes left in current block
+
+/* Copy 'name' into the arena. Blocks are chained through their first
+ * word and never move, so the copies can be referenced directly. */
+static const char *arena_copy(const char *name) {
+  size_t len = strlen(name) + 1;
+  char *copy;
+
+  if (len > block_left) {
+    char *b = (char *)malloc(CMDTAB_BLOCK);
+
+    if (!b) return (NULL);
+
+    *(char **)b = block;
+    block = b;
+    block_left = CMDTAB_BLOCK - sizeof (char *);
+  }
+
+  copy = block + CMDTAB_BLOCK - block_left;
+  memcpy(copy, name, len);
+  block_left -= len;
+
+  return (copy);
+}
+
+static void arena_free(void) {
+  while (block) {
+    char *next = *(char **)block;
+
+    free(block);
+    block = next;
+  }
+
+  block_left = 0;
+}
+
+#endif // POSIX
+
+static uint8_t table_add(const char *name, uint8_t dir) {
+  if (table_len == table_max) {
+    uint16_t max = table_max ? table_max * 2 : 32;
+    cmdtab_t *t;
+
+    if (table_max > UINT16_MAX / 2) return (0);
+
+    t = (cmdtab_t *)realloc(table, sizeof (cmdtab_t) * max);
+
+    if (!t) return (0);
+
+    table = t;
+    table_max = max;
+  }
+
+  table[table_len].name = name;
+  table[table_len].dir  = dir;
+#ifdef HAVE_FUZZY
+  {
+    size_t len = strlen(name);
+
+    table[table_len].len = (len > 255) ? 255 : (uint8_t)len;
+    table[table_len].sig = cmdtab_sig(name, table[table_len].len);
+  }
+#endif
+  table_len++;
+
+  return (1);
+}
+
+static int compare(const void *a, const void *b) {
+  const cmdtab_t *x = (const cmdtab_t *)a;
+  const cmdtab_t *y = (const cmdtab_t *)b;
+  int ret = strcmp(x->name, y->name);
+
+  if (ret) return (ret);
+
+  return ((int)x->dir - (int)y->dir);
+}
+
+/* Sort the table and drop duplicates. Builtins come first and shadow
+ * executables, executables shadow those found later in PATH. */
+static void table_sort(void) {
+  uint16_t i, n = 0;
+
+  if (!table_len) return;
+
+  qsort(table, table_len, sizeof (cmdtab_t), compare);
+
+  for (i=1; i<table_len; i++) {
+    if (strcmp(table[n].name, table[i].name)) {
+      table[++n] = table[i];
+    }
+  }
+
+  table_len = n + 1;
+}
+
+static void table_build(void) {
+  const char *ptr = builtin;
+
+  table_len = 0;
+  gen++;
+
+  while (ptr && *ptr) {
+    table_add(ptr, CMDTAB_BUILTIN);
+    ptr += strlen(ptr) + 1;
+  }
+
+#ifdef POSIX
+  {
+    uint8_t i;
+
+    arena_free();
+
+    for (i=0; i<ndirs; i++) {
+      struct dirent *entry;
+      DIR *dir = opendir(dirs[i]);
+
+      if (!dir) continue;
+
+      while ((entry = readdir(dir))) {
+        const char *name;
+
+        if (entry->d_name[0] == '.') continue;
+        if (entry->d_type == DT_DIR) continue;
+
+        // the file system may not tell, or the name is a link to a dir
+        if ((entry->d_type == DT_UNKNOWN) || (entry->d_type == DT_LNK)) {
+          struct stat st;
+
+          if (fstatat(dirfd(dir), entry->d_name, &st, 0)) continue;
+          if (S_ISDIR(st.st_mode)) continue;
+        }
+
+        if (faccessat(dirfd(dir), entry->d_name, X_OK, 0)) continue;
+
+        if (!(name = arena_copy(entry->d_name))) break;
+        if (!table_add(name, i + 1)) break;
+      }
+
+      closedir(dir);
+    }
+  }
+#endif
+
+  table_sort();
+}
+
+/* Set the packed, '\0' separated and terminated list of builtin commands
+ * and build the index. */
+void cmdtab_init(const char *builtins) {
+  builtin = builtins;
+
+  table_build();
+}
+
+void cmdtab_fini(void) {
+  free(table);
+  table = NULL;
+  table_len = table_max = 0;
+
+#ifdef POSIX
+  arena_free();
+  free(path);
+  path = NULL;
+  ndirs = 0;
+  scanned = 0;
+#endif
+}
+
+/* Rebuild the index, if PATH or one of its directories changed since the
+ * last time. Unless 'force' is set, the directories are only looked at
+ * again after CMDTAB_RESCAN seconds, so that this can be called on every
+ * key press. */
+void cmdtab_update(uint8_t force) {
+#ifdef POSIX
+  const char *env = getenv("PATH");
+  uint8_t i, changed = 0;
+  time_t now = time(NULL);
+  struct stat st;
+
+  if (!env) env = "";
+
+  if (!path || strcmp(path, env)) {
+    char *p;
+
+    free(path);
+    path = strdup(env);
+    ndirs = 0;
+
+    // without a copy of PATH, only the builtins are left
+    if (!path) {
+      table_build();
+      return;
+    }
+
+    for (p = path; *p && (ndirs < CMDTAB_DIRS); ) {
+      dirs[ndirs] = p;
+      mtime[ndirs++] = 0;
+
+      while (*p && (*p != ':')) p++;
+      if (*p) *p++ = '\0';
+    }
+
+    changed = 1;
+  } else if (!force && (now - scanned < CMDTAB_RESCAN)) {
+    return;
+  }
+
+  scanned = now;
+
+  for (i=0; i<ndirs; i++) {
+    time_t t = stat(dirs[i], &st) ? 0 : st.st_mtime;
+
+    if (t != mtime[i]) {
+      mtime[i] = t;
+      changed = 1;
+    }
+  }
+
+  if (changed) table_build();
+#endif
+}
+
+/* Returns the generation of the index, that changes with every build. */
+uint32_t cmdtab_gen(void) {
+  return (gen);
+}
+
+/* Binary search the first name not sorting before the first 'len'
+ * characters of 'prefix'. */
+static uint16_t table_lower(const char *prefix, uint8_t len) {
+  uint16_t lo = 0, hi = table_len;
+
+  while (lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+
+    if (strncmp(table[mid].name, prefix, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return (lo);
+}
+
+/* Locate all names starting with the first 'len' characters of 'prefix'.
+ * Returns the number of matches, the index of the first one is stored in
+ * 'first'. */
+uint16_t cmdtab_find(const char *prefix, uint8_t len, uint16_t *first) {
+  uint16_t lo = table_lower(prefix, len), n = 0;
+
+  *first = lo;
+
+  while ((lo + n < table_len) && !strncmp(table[lo + n].name, prefix, len)) {
+    n++;
+  }
+
+  return (n);
+}
+
+/* Returns non-zero if the first 'len' characters of 'name' are a known
+ * command. An exact match sorts first among the names it prefixes. */
+uint8_t cmdtab_exists(const char *name, uint8_t len) {
+  uint16_t i = table_lower(name, len);
+
+  return ((i < table_len) && !strncmp(table[i].name, name, len) &&
+          !table[i].name[len]);
+}
+
+#ifdef HAVE_FUZZY
+
+/* Returns the set of characters in the first 'len' characters of 'name',
+ * ignoring case, one bit per character modulo 32. */
+uint32_t cmdtab_sig(const char *name, uint8_t len) {
+  uint32_t sig = 0;
+
+  while (len--) sig |= (uint32_t)1 << (tolower((uint8_t)*name++) & 31);
+
+  return (sig);
+}
+
+/* Advance 'i' to the first name from 'i' on, that may be within 'bound'
+ * edits of a name of length 'len' and signature 'sig'. Each edit changes
+ * the length by one at most and each character missing in a name needs
+ * an edit of its own. Returns 0, if there is no such name left. */
+uint8_t cmdtab_near(uint32_t sig, uint8_t len, uint8_t bound, uint16_t *i) {
+  for (; *i < table_len; (*i)++) {
+    const cmdtab_t *t = &table[*i];
+    uint32_t missing;
+    uint8_t n;
+
+    if ((t->len > len + bound) || (t->len + bound < len)) continue;
+
+    for (n=0, missing = sig & ~t->sig; missing && (n <= bound); n++) {
+      missing &= missing - 1;
+    }
+
+    if (n <= bound) return (1);
+  }
+
+  return (0);
+}
+
+#endif // HAVE_FUZZY
+
+#ifdef POSIX
+/* Store the path of the executable 'name' in the 'size' bytes at 'buf'.
+ * Returns 0, if 'name' is a builtin or no executable in PATH. */
+uint8_t cmdtab_which(const char *name, char *buf, uint16_t size) {
+  size_t len = strlen(name);
+  uint16_t i;
+  uint8_t dir;
+
+  if (len > 255) return (0);
+
+  i = table_lower(name, len);
+
+  if ((i == table_len) || strcmp(table[i].name, name)) return (0);
+  if ((dir = table[i].dir) == CMDTAB_BUILTIN) return (0);
+
+  if (strlen(dirs[dir - 1]) + len + 2 > size) return (0);
+
+  strcpy(buf, dirs[dir - 1]);
+  strcat(buf, "/");
+  strcat(buf, name);
+
+  return (1);
+}
+#endif // POSIX
+
+uint16_t cmdtab_size(void) {
+  return (table_len);
+}
+
+const char *cmdtab_name(uint16_t i) {
+  return (table[i].name);
+}
+
+/* Returns the PATH directory index (starting at 1) the command was found
+ * in, or CMDTAB_BUILTIN. */
+uint8_t cmdtab_dir(uint16_t i) {
+  return (table[i].dir);
+}
+
+#endif // HAVE_COMPLETION
@@ -0,0 +1,29 @@
+#ifndef _CMDTAB_H_
+#define _CMDTAB_H_
+
+#include <stdint.h>
+
+#define CMDTAB_BUILTIN 0 // directory index of builtin commands
+
+void        cmdtab_init(const char *builtins);
+void        cmdtab_fini(void);
+void        cmdtab_update(uint8_t force);
+
+uint16_t    cmdtab_find(const char *prefix, uint8_t len, uint16_t *first);
+uint8_t     cmdtab_exists(const char *name, uint8_t len);
+uint16_t    cmdtab_size(void);
+uint32_t    cmdtab_gen(void);
+
+#ifdef POSIX
+uint8_t     cmdtab_which(const char *name, char *buf, uint16_t size);
+#endif
+
+#ifdef HAVE_FUZZY
+uint32_t    cmdtab_sig(const char *name, uint8_t len);
+uint8_t     cmdtab_near(uint32_t sig, uint8_t len, uint8_t bound, uint16_t *i);
+#endif
+
+const char *cmdtab_name(uint16_t i);
+uint8_t     cmdtab_dir(uint16_t i);
+
+#endif // _CMDTAB_H_
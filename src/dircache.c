@@ -0,0 +1,257 @@
+/* dircache.c -- cache of sorted directory listings.
+ *
+ * A small number of directories is kept in memory with their entries
+ * sorted by name. A cached listing is reused, as long as the directory
+ * still has the same device, inode and modification time, so only one
+ * stat() is needed to answer repeated lookups, even for huge directories.
+ * Each name is stored in an arena, preceded by its type byte.
+ *
+ * Listings can be read incrementally with dircache_next(), that returns
+ * the entries in directory order, even after the listing was completed
+ * and sorted on behalf of someone else. Every time a slot is read again,
+ * it gets a new generation number, so that an incremental reader can
+ * tell that its position is no longer valid.
+ */
+
+#ifdef HAVE_DIRCACHE
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+
+#define DIRCACHE_SLOTS 4    // number of cached directories
+#define DIRCACHE_ARENA 4096 // initial size of the name arena
+#define DIRCACHE_OFFS  256  // initial size of the offset vector
+
+struct dircache_t {
+  dev_t           dev;    /* Device of the directory. */
+  ino_t           ino;    /* Inode of the directory. */
+  struct timespec mtime;  /* Modification time when it was read. */
+  uint32_t        tick;   /* Last use, for LRU replacement. */
+  uint32_t        gen;    /* Generation of the listing. */
+  DIR            *dir;    /* Open while the listing is being read. */
+  uint32_t        len;    /* Number of entries. */
+  uint32_t        max;    /* Capacity of the offset vector. */
+  uint32_t       *offs;   /* Offsets of the entry names in the arena. */
+  uint32_t       *sorted; /* The same offsets in name order, once complete. */
+  size_t          used;   /* Bytes used in the arena. */
+  size_t          size;   /* Size of the arena. */
+  char           *arena;  /* Type bytes and names. */
+};
+
+static dircache_t  cache[DIRCACHE_SLOTS];
+static uint32_t    tick = 0;
+static uint32_t    gen = 0;
+static const char *sorting = NULL; // arena of the listing being sorted
+
+static int compare(const void *a, const void *b) {
+  return (strcmp(sorting + *(const uint32_t *)a, sorting + *(const uint32_t *)b));
+}
+
+static void slot_free(dircache_t *d) {
+  if (d->dir) closedir(d->dir);
+
+  if (d->sorted != d->offs) free(d->sorted);
+  free(d->offs);
+  free(d->arena);
+  memset(d, 0, sizeof (dircache_t));
+}
+
+/* Read the next entry of the directory into the arena. Returns 0 when
+ * the listing is complete, it is sorted then. */
+static uint8_t slot_read(dircache_t *d) {
+  struct dirent *entry;
+
+  while ((entry = readdir(d->dir))) {
+    size_t len = strlen(entry->d_name) + 2;
+    uint8_t type = 0;
+
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+    if (d->used + len > d->size) {
+      size_t size = d->size ? d->size : DIRCACHE_ARENA;
+      char *a;
+
+      while (d->used + len > size) size *= 2;
+
+      if (!(a = (char *)realloc(d->arena, size))) break;
+
+      d->arena = a;
+      d->size = size;
+    }
+
+    if (d->len == d->max) {
+      uint32_t max = d->max ? d->max * 2 : DIRCACHE_OFFS;
+      uint32_t *o = (uint32_t *)realloc(d->offs, sizeof (uint32_t) * max);
+
+      if (!o) break;
+
+      d->offs = o;
+      d->max = max;
+    }
+
+    if (entry->d_type == DT_DIR) type = DIRCACHE_DIR;
+
+    /* Follow symlinks, to complete links to directories like those. */
+    if ((entry->d_type == DT_LNK) || (entry->d_type == DT_UNKNOWN)) {
+      struct stat st;
+
+      if (!fstatat(dirfd(d->dir), entry->d_name, &st, 0) && S_ISDIR(st.st_mode)) {
+        type = DIRCACHE_DIR;
+      }
+    }
+
+    d->arena[d->used] = type;
+    memcpy(d->arena + d->used + 1, entry->d_name, len - 1);
+    d->offs[d->len++] = d->used + 1;
+    d->used += len;
+
+    return (1);
+  }
+
+  closedir(d->dir);
+  d->dir = NULL;
+
+  if (!d->len) return (0);
+
+  /* Sort a copy, readers in directory order may still be going. When
+   * there is no memory for it, sort in place and cut those readers off. */
+  if ((d->sorted = (uint32_t *)malloc(sizeof (uint32_t) * d->len))) {
+    memcpy(d->sorted, d->offs, sizeof (uint32_t) * d->len);
+  } else {
+    d->sorted = d->offs;
+    d->gen = ++gen;
+  }
+
+  sorting = d->arena;
+  qsort(d->sorted, d->len, sizeof (uint32_t), compare);
+  sorting = NULL;
+
+  return (0);
+}
+
+/* Returns the listing of directory 'path', that is either complete or in
+ * the state a previous call left it. It is started over, if the directory
+ * has been modified since. */
+dircache_t *dircache_open(const char *path) {
+  dircache_t *d = NULL;
+  struct stat st;
+  uint8_t i;
+
+  if (stat(path, &st) || !S_ISDIR(st.st_mode)) return (NULL);
+
+  for (i=0; i<DIRCACHE_SLOTS; i++) {
+    if (cache[i].tick && (cache[i].dev == st.st_dev) && (cache[i].ino == st.st_ino)) {
+      d = &cache[i];
+      break;
+    }
+
+    /* Otherwise replace an empty or the least recently used slot. */
+    if (!d || (cache[i].tick < d->tick)) d = &cache[i];
+  }
+
+  if (d->tick && (d->dev == st.st_dev) && (d->ino == st.st_ino) &&
+      (d->mtime.tv_sec  == st.st_mtim.tv_sec) &&
+      (d->mtime.tv_nsec == st.st_mtim.tv_nsec)) {
+    d->tick = ++tick;
+    return (d);
+  }
+
+  slot_free(d);
+
+  if (!(d->dir = opendir(path))) return (NULL);
+
+  d->dev   = st.st_dev;
+  d->ino   = st.st_ino;
+  d->mtime = st.st_mtim;
+  d->tick  = ++tick;
+  d->gen   = ++gen;
+
+  return (d);
+}
+
+/* Returns the complete, sorted listing of directory 'path'. */
+dircache_t *dircache_get(const char *path) {
+  dircache_t *d = dircache_open(path);
+
+  if (d) {
+    while (d->dir && slot_read(d));
+  }
+
+  return (d);
+}
+
+/* Returns the entry 'i' in directory order and its type, reading the
+ * directory as far as needed. NULL is returned after the last entry. */
+const char *dircache_next(dircache_t *d, uint32_t i, uint8_t *type) {
+  if (i > d->len) return (NULL);
+  if ((i == d->len) && (!d->dir || !slot_read(d))) return (NULL);
+
+  if (type) *type = (uint8_t)d->arena[d->offs[i] - 1];
+
+  return (d->arena + d->offs[i]);
+}
+
+uint8_t dircache_ready(dircache_t *d) {
+  return (d->dir == NULL);
+}
+
+/* Returns the generation of the listing, that changes whenever it is
+ * started over, so positions taken from dircache_next() are lost. */
+uint32_t dircache_gen(dircache_t *d) {
+  return (d->gen);
+}
+
+void dircache_fini(void) {
+  uint8_t i;
+
+  for (i=0; i<DIRCACHE_SLOTS; i++) {
+    slot_free(&cache[i]);
+  }
+}
+
+/* Locate all entries of a complete listing starting with the first 'len'
+ * characters of 'prefix'. Returns the number of matches, the first one is
+ * stored in 'first'. */
+uint32_t dircache_find(dircache_t *d, const char *prefix, uint8_t len, uint32_t *first) {
+  uint32_t lo = 0, hi = d->len, n = 0;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (strncmp(d->arena + d->sorted[mid], prefix, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  *first = lo;
+
+  while ((lo + n < d->len) && !strncmp(d->arena + d->sorted[lo + n], prefix, len)) {
+    n++;
+  }
+
+  return (n);
+}
+
+uint32_t dircache_size(dircache_t *d) {
+  return (d->len);
+}
+
+const char *dircache_name(dircache_t *d, uint32_t i) {
+  return (d->arena + d->sorted[i]);
+}
+
+uint8_t dircache_type(dircache_t *d, uint32_t i) {
+  return ((uint8_t)d->arena[d->sorted[i] - 1]);
+}
+
+#endif // HAVE_DIRCACHE
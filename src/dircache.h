@@ -0,0 +1,24 @@
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include <stdint.h>
+
+#define DIRCACHE_DIR (1<<0) // entry is a directory
+
+typedef struct dircache_t dircache_t;
+
+dircache_t *dircache_open(const char *path);
+dircache_t *dircache_get(const char *path);
+void        dircache_fini(void);
+
+const char *dircache_next(dircache_t *d, uint32_t i, uint8_t *type);
+uint8_t     dircache_ready(dircache_t *d);
+uint32_t    dircache_gen(dircache_t *d);
+
+uint32_t    dircache_find(dircache_t *d, const char *prefix, uint8_t len, uint32_t *first);
+uint32_t    dircache_size(dircache_t *d);
+
+const char *dircache_name(dircache_t *d, uint32_t i);
+uint8_t     dircache_type(dircache_t *d, uint32_t i);
+
+#endif // _DIRCACHE_H_
@@ -0,0 +1,142 @@
+/* exec.c -- starting external commands.
+ *
+ * Commands are started with posix_spawn(), that the C library implements
+ * with vfork() semantics: the child borrows the memory of push until it
+ * has exec'd, so nothing is copied and no shell is involved. The standard
+ * input and output of the child are set up by the spawn file actions.
+ *
+ * While commands run in the foreground, the terminal is back in its
+ * initial mode and push ignores the signals typed at it, that are meant
+ * for the commands. The commands themselves start with those signals at
+ * their defaults.
+ */
+
+#ifdef HAVE_EXEC
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <spawn.h>
+
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "posix.h"
+#include "exec.h"
+
+extern char **environ;
+
+static struct sigaction intr, quit; // dispositions outside of commands
+static uint8_t depth = 0;           // nesting of exec_begin() calls
+static uint8_t taken = 0;           // terminal was taken from push
+
+/* Hand the terminal over to commands run in the foreground. Calls nest,
+ * as builtins in a pipeline may run scripts. */
+void exec_begin(void) {
+  struct sigaction ign;
+
+  if (depth++) return;
+
+  memset(&ign, 0, sizeof (ign));
+  ign.sa_handler = SIG_IGN;
+
+  sigaction(SIGINT, &ign, &intr);
+  sigaction(SIGQUIT, &ign, &quit);
+
+  taken = posix_fini();
+}
+
+/* Take the terminal back, once the foreground commands are done. */
+void exec_end(void) {
+  if (--depth) return;
+
+  if (taken) posix_init();
+
+  sigaction(SIGINT, &intr, NULL);
+  sigaction(SIGQUIT, &quit, NULL);
+}
+
+/* Start 'argv' with its standard streams on 'in', 'out' and 'err'. The
+ * executable is 'path' or, if that is NULL, 'argv[0]' looked up in PATH.
+ * Returns the process id, or -1 if the command can't be started. */
+pid_t exec_spawn(char **argv, const char *path, int in, int out, int err) {
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t sigs;
+  pid_t pid;
+  int ret;
+
+  if ((ret = posix_spawn_file_actions_init(&fa))) {
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(ret));
+    return (-1);
+  }
+
+  if ((ret = posix_spawnattr_init(&attr))) {
+    posix_spawn_file_actions_destroy(&fa);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(ret));
+    return (-1);
+  }
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGQUIT);
+  sigaddset(&sigs, SIGPIPE);
+
+  posix_spawnattr_setsigdefault(&attr, &sigs);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+  if (in != 0)  posix_spawn_file_actions_adddup2(&fa, in, 0);
+  if (out != 1) posix_spawn_file_actions_adddup2(&fa, out, 1);
+  if (err != 2) posix_spawn_file_actions_adddup2(&fa, err, 2);
+
+  if (path) {
+    ret = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+  } else {
+    ret = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+
+  if (ret) {
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(ret));
+    return (-1);
+  }
+
+  return (pid);
+}
+
+/* Wait for process 'pid' to end, returns its wait status. */
+int exec_wait(pid_t pid) {
+  int status = 0;
+
+  while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR));
+
+  return (status);
+}
+
+/* Returns the exit status of a command with wait status 'status', which
+ * is 128 plus the signal number for a command killed by a signal. Deaths
+ * by signal are reported, unless it was an interrupt or a broken pipe. */
+uint8_t exec_status(int status) {
+  int sig;
+
+  if (WIFEXITED(status)) return (WEXITSTATUS(status));
+  if (!WIFSIGNALED(status)) return (0);
+
+  sig = WTERMSIG(status);
+
+  if (sig == SIGINT) {
+    fprintf(stderr, "\n");
+  } else if (sig != SIGPIPE) {
+    fprintf(stderr, "%s%s\n", strsignal(sig),
+            WCOREDUMP(status) ? " (core dumped)" : "");
+  }
+
+  return (128 + sig);
+}
+
+#endif // HAVE_EXEC
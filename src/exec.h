@@ -0,0 +1,15 @@
+#ifndef _EXEC_H_
+#define _EXEC_H_
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+void    exec_begin(void);
+void    exec_end(void);
+
+pid_t   exec_spawn(char **argv, const char *path, int in, int out, int err);
+int     exec_wait(pid_t pid);
+uint8_t exec_status(int status);
+
+#endif // _EXEC_H_
@@ -14,6 +14,7 @@ int8_t fileio_mkdir(const char *dir);
 int8_t fileio_rmdir(const char *dir);
 
 int8_t fileio_ls(uint8_t flags, const char *path);
+int8_t fileio_cat(const char *path);
 void fileio_mount(const char *dev, const char *dir);
 
 void fileio_error(const char *cmd);
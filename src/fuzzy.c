@@ -0,0 +1,114 @@
+/* fuzzy.c -- approximate matching of names.
+ *
+ * A pattern is compiled once into one bit mask per character, telling at
+ * which pattern positions the character occurs. The edit distance to a
+ * name is then computed with Myers' bit-parallel algorithm, handling the
+ * whole pattern (up to 32 characters) in each step, so matching costs a
+ * handful of word operations per character of the name. Matching ignores
+ * the case of letters.
+ */
+
+#ifdef HAVE_FUZZY
+
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "fuzzy.h"
+
+/* Compile the first 'len' characters of 'pattern'. Names further away
+ * than 'bound' edits are rejected by fuzzy_score(). */
+void fuzzy_compile(fuzzy_t *f, const char *pattern, uint8_t len, uint8_t bound) {
+  uint8_t i;
+
+  if (len > FUZZY_MAX) len = FUZZY_MAX;
+
+  memset(f->peq, 0, sizeof (f->peq));
+
+  for (i=0; i<len; i++) {
+    uint8_t c = (uint8_t)pattern[i];
+
+    f->peq[tolower(c)] |= (uint32_t)1 << i;
+    f->peq[toupper(c)] |= (uint32_t)1 << i;
+  }
+
+  f->pattern = pattern;
+  f->len     = len;
+  f->bound   = bound;
+}
+
+/* Returns the edit distance between the pattern and 'text', or if 'prefix'
+ * is set, between the pattern and the closest prefix of 'text'. Swapping
+ * two adjacent characters counts as one edit (Hyyroe's extension). The
+ * pattern must not be empty. */
+uint8_t fuzzy_distance(const fuzzy_t *f, const char *text, uint8_t prefix) {
+  uint32_t vp = ~(uint32_t)0, vn = 0, d0 = 0, peq = 0;
+  uint32_t last = (uint32_t)1 << (f->len - 1);
+  uint8_t score = f->len, best = f->len;
+
+  while (*text) {
+    uint32_t eq = f->peq[(uint8_t)*text++];
+    uint32_t tr = (((~d0) & eq) << 1) & peq;
+    uint32_t hp, hn;
+
+    d0 = (((eq & vp) + vp) ^ vp) | eq | vn | tr;
+    hp = vn | ~(d0 | vp);
+    hn = d0 & vp;
+
+    if (hp & last) {
+      score++;
+    } else if (hn & last) {
+      score--;
+    }
+
+    /* The first row grows by one per column, as the alignment is
+     * anchored at the start of the name. */
+    hp = (hp << 1) | 1;
+    hn = (hn << 1);
+
+    vp = hn | ~(d0 | hp);
+    vn = hp & d0;
+    peq = eq;
+
+    if (score < best) best = score;
+  }
+
+  return (prefix ? best : score);
+}
+
+/* Rate how well 'text' matches the pattern, lower is better. A name that
+ * contains the pattern as a subsequence rates by how spread out the matched
+ * characters are, a name starting with a few typos of the pattern rates by
+ * the number of edits, whatever is better. Returns FUZZY_NONE, if 'text'
+ * matches neither way. */
+uint16_t fuzzy_score(const fuzzy_t *f, const char *text) {
+  uint16_t cost = FUZZY_NONE;
+  uint8_t i = 0, j, first = 0, last = 0, gaps = 0, d;
+
+  if (!f->len) return (0);
+
+  for (j=0; text[j] && (i < f->len) && (j < 255); j++) {
+    if (tolower((uint8_t)text[j]) == tolower((uint8_t)f->pattern[i])) {
+      if (i == 0) {
+        first = j;
+      } else if (j != last + 1) {
+        gaps++;
+      }
+
+      last = j;
+      i++;
+    }
+  }
+
+  if (i == f->len) {
+    cost = 4 + (first ? 2 : 0) + 2 * gaps + (last - first + 1 - f->len);
+  }
+
+  d = fuzzy_distance(f, text, 1);
+
+  if ((d <= f->bound) && (8 * d < cost)) cost = 8 * d;
+
+  return (cost);
+}
+
+#endif // HAVE_FUZZY
@@ -0,0 +1,21 @@
+#ifndef _FUZZY_H_
+#define _FUZZY_H_
+
+#include <stdint.h>
+
+#define FUZZY_MAX  32     // max pattern length
+#define FUZZY_NONE 0xffff // no match
+
+typedef struct fuzzy_t {
+  uint32_t    peq[256]; /* Bit mask of pattern positions per character. */
+  const char *pattern;  /* The pattern itself. */
+  uint8_t     len;      /* Pattern length. */
+  uint8_t     bound;    /* Max edit distance accepted. */
+} fuzzy_t;
+
+void     fuzzy_compile(fuzzy_t *f, const char *pattern, uint8_t len, uint8_t bound);
+
+uint8_t  fuzzy_distance(const fuzzy_t *f, const char *text, uint8_t prefix);
+uint16_t fuzzy_score(const fuzzy_t *f, const char *text);
+
+#endif // _FUZZY_H_
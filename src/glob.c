@@ -0,0 +1,412 @@
+/* glob.c -- file name expansion.
+ *
+ * A pattern is compiled once, before any directory is read, into a list
+ * of segments, one per path component. A segment without wildcards is a
+ * literal name, that is appended to the path without listing anything, so
+ * '*.h' in /usr/include/sys only lists a single directory. A segment with
+ * wildcards is compiled into a small program of character, '?', '*' and
+ * class instructions. Its literal prefix selects the run of entries that
+ * can match in the sorted listing from dircache with a binary search, the
+ * program only runs on those.
+ *
+ * The program keeps one backtracking position, the last '*'. A name is
+ * matched in time linear in its length for patterns with a single '*',
+ * and never worse than the product of the lengths of name and pattern.
+ *
+ * A '**' segment matches any number of directories, a trailing one every
+ * name below. A trailing slash only matches directories. Names starting
+ * with a dot are only matched by a pattern starting with a dot.
+ */
+
+#ifdef HAVE_GLOB
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+#include "glob.h"
+
+#define GLOB_PATH    1024 // longest path built
+#define GLOB_DEPTH   32   // directories descended into by '**'
+
+#define GLOB_END     0    // end of the program
+#define GLOB_CHAR    1    // followed by the character
+#define GLOB_ANY     2    // '?'
+#define GLOB_STAR    3    // '*'
+#define GLOB_SET     4    // followed by a bitmap of 256 characters
+
+#define GLOB_LITERAL 0    // segment without wildcards
+#define GLOB_MATCH   1    // segment with wildcards
+#define GLOB_RECURSE 2    // '**'
+
+typedef struct glob_seg_t {
+  uint8_t        type;   /* GLOB_LITERAL, GLOB_MATCH or GLOB_RECURSE. */
+  uint8_t        dot;    /* Matches names starting with a dot. */
+  uint8_t        len;    /* Length of the literal prefix. */
+  char          *prefix; /* Literal prefix, the whole name if literal. */
+  uint8_t       *prog;   /* Program matching the rest of a name. */
+} glob_seg_t;
+
+typedef struct glob_t {
+  glob_seg_t    *seg;    /* Segments of the pattern. */
+  uint16_t       nseg;   /* Number of segments. */
+  uint8_t        slash;  /* Pattern ends with a slash. */
+  uint16_t       max;    /* Number of matches wanted. */
+  uint16_t       count;  /* Number of matches found. */
+  char         **list;   /* Matches, in arena 'a'. */
+  parse_arena_t *a;
+  char           path[GLOB_PATH];
+} glob_t;
+
+static const char empty[] = "";
+
+/* Returns the index of the ']' closing the class opened by the '[' at
+ * 's[i]', 0 if there is none. A ']' right after the '[' or a leading '!'
+ * or '^' is a member. */
+static uint16_t set_end(const char *s, uint16_t i, uint16_t len) {
+  uint16_t j = i + 1;
+
+  if ((j < len) && ((s[j] == '!') || (s[j] == '^'))) j++;
+  if ((j < len) && (s[j] == ']')) j++;
+
+  for (; j < len; j++) {
+    if (s[j] == ']') return (j);
+    if ((s[j] == '\\') && (j + 1 < len)) j++;
+  }
+
+  return (0);
+}
+
+/* Set the bits of the characters of the class 's' of length 'len', the
+ * text between the brackets, in the 32 bytes at 'map'. */
+static void set_compile(uint8_t *map, const char *s, uint16_t len) {
+  uint16_t i = 0;
+  uint8_t neg = 0, lo, hi, c;
+
+  memset(map, 0, 32);
+
+  if ((len > 0) && ((s[0] == '!') || (s[0] == '^'))) {
+    neg = 1;
+    i++;
+  }
+
+  while (i < len) {
+    lo = (uint8_t)s[i++];
+    if ((lo == '\\') && (i < len)) lo = (uint8_t)s[i++];
+
+    hi = lo;
+
+    if ((i + 1 < len) && (s[i] == '-')) {
+      hi = (uint8_t)s[i + 1];
+      i += 2;
+      if ((hi == '\\') && (i < len)) hi = (uint8_t)s[i++];
+    }
+
+    for (c = lo; c <= hi; c++) {
+      map[c >> 3] |= 1 << (c & 7);
+      if (c == hi) break;
+    }
+  }
+
+  if (neg) {
+    for (i=0; i<32; i++) map[i] = ~map[i];
+  }
+
+  map[0] &= ~1; // never the end of the name
+}
+
+/* Compile segment 's' of length 'len' into 'g', with memory taken from
+ * arena 'a'. Returns 0, if there is no memory. */
+static uint8_t compile(glob_seg_t *g, const char *s, uint16_t len, parse_arena_t *a) {
+  uint16_t i = 0, end, n = 0;
+  uint32_t size = 1;
+  uint8_t *p, star = 0;
+
+  if ((len == 2) && (s[0] == '*') && (s[1] == '*')) {
+    g->type   = GLOB_RECURSE;
+    g->dot    = 0;
+    g->len    = 0;
+    g->prefix = (char *)empty;
+    return (1);
+  }
+
+  if (!(g->prefix = (char *)parse_arena_alloc(a, len + 1))) return (0);
+
+  while ((i < len) && (n < 255)) {
+    char c = s[i];
+
+    if ((c == '*') || (c == '?') || ((c == '[') && set_end(s, i, len))) break;
+    if ((c == '\\') && (i + 1 < len)) c = s[++i];
+
+    g->prefix[n++] = c;
+    i++;
+  }
+
+  g->prefix[n] = '\0';
+  g->len  = n;
+  g->dot  = (n > 0) && (g->prefix[0] == '.');
+  g->type = (i == len) ? GLOB_LITERAL : GLOB_MATCH;
+
+  if (g->type == GLOB_LITERAL) return (1);
+
+  for (end = i; end < len; end++) size += (s[end] == '[') ? 34 : 2;
+  if (size > UINT16_MAX) return (0);
+
+  if (!(g->prog = p = (uint8_t *)parse_arena_alloc(a, size))) return (0);
+
+  while (i < len) {
+    char c = s[i++];
+
+    if (c == '*') {
+      if (!star) *p++ = GLOB_STAR;
+      star = 1;
+      continue;
+    }
+
+    star = 0;
+
+    if (c == '?') {
+      *p++ = GLOB_ANY;
+    } else if ((c == '[') && (end = set_end(s, i - 1, len))) {
+      *p++ = GLOB_SET;
+      set_compile(p, s + i, end - i);
+      p += 32;
+      i = end + 1;
+    } else {
+      if ((c == '\\') && (i < len)) c = s[i++];
+
+      *p++ = GLOB_CHAR;
+      *p++ = (uint8_t)c;
+    }
+  }
+
+  *p = GLOB_END;
+
+  return (1);
+}
+
+/* Returns non-zero, if name 's' matches program 'p'. */
+static uint8_t match(const uint8_t *p, const char *s) {
+  const uint8_t *star = NULL;
+  const char *back = NULL;
+
+  for (;;) {
+    uint8_t c = (uint8_t)*s;
+
+    switch (*p) {
+      case GLOB_END:
+        if (!c) return (1);
+        break;
+
+      case GLOB_STAR:
+        star = ++p;
+        back = s;
+        continue;
+
+      case GLOB_ANY:
+        if (c) { p++; s++; continue; }
+        break;
+
+      case GLOB_CHAR:
+        if (c && (c == p[1])) { p += 2; s++; continue; }
+        break;
+
+      case GLOB_SET:
+        if (p[1 + (c >> 3)] & (1 << (c & 7))) { p += 33; s++; continue; }
+        break;
+    }
+
+    // let the last '*' take one more character and try again from there
+    if (!star || !*back) return (0);
+
+    p = star;
+    s = ++back;
+  }
+}
+
+/* Append 'name' to the path of length 'len'. Returns the new length, 0
+ * if it doesn't fit. */
+static uint16_t join(glob_t *g, uint16_t len, const char *name) {
+  size_t n = strlen(name);
+
+  if (len && (g->path[len - 1] != '/')) {
+    if (len + 1 >= GLOB_PATH) return (0);
+    g->path[len++] = '/';
+  }
+
+  if (len + n + 1 >= GLOB_PATH) return (0);
+
+  memcpy(g->path + len, name, n + 1);
+
+  return (len + n);
+}
+
+/* Add the path of length 'len' to the matches. Matches beyond the
+ * maximum are only counted. */
+static void add(glob_t *g, uint16_t len) {
+  char *copy;
+
+  if (g->count++ >= g->max) return;
+
+  if (g->slash) g->path[len++] = '/';
+
+  if (!(copy = (char *)parse_arena_alloc(g->a, len + 1))) {
+    g->count--;
+    return;
+  }
+
+  memcpy(copy, g->path, len);
+  copy[len] = '\0';
+
+  g->list[g->count - 1] = copy;
+}
+
+/* Match segment 'seg' and the ones after it below the path of length
+ * 'len'. 'depth' counts the directories entered by '**'. */
+static void walk(glob_t *g, uint16_t seg, uint16_t len, uint8_t depth) {
+  const glob_seg_t *s = &g->seg[seg];
+  uint8_t last = (seg + 1 == g->nseg), dirs = !last || g->slash;
+  char *names = NULL, *name;
+  size_t used = 0, size = 0;
+  uint32_t i, first, n;
+  uint16_t end;
+  dircache_t *d;
+  struct stat st;
+
+  if (g->count > g->max) return;
+
+  if (s->type == GLOB_LITERAL) {
+    if (!(end = join(g, len, s->prefix))) return;
+
+    if (!last) {
+      walk(g, seg + 1, end, depth);
+    } else if (g->slash ? !stat(g->path, &st) && S_ISDIR(st.st_mode) : !lstat(g->path, &st)) {
+      add(g, end);
+    }
+
+    return;
+  }
+
+  if (s->type == GLOB_RECURSE) {
+    walk(g, seg + 1, len, depth); // no directory at all
+    if (depth == GLOB_DEPTH) return;
+  }
+
+  g->path[len] = '\0';
+
+  if (!(d = dircache_get(len ? g->path : "."))) return;
+
+  n = dircache_find(d, s->prefix, s->len, &first);
+
+  for (i=first; i<first + n; i++) {
+    const char *e = dircache_name(d, i);
+
+    if ((*e == '.') && !s->dot) continue;
+    if (dirs && !(dircache_type(d, i) & DIRCACHE_DIR)) continue;
+    if ((s->type == GLOB_MATCH) && !match(s->prog, e + s->len)) continue;
+
+    if (last) {
+      if ((end = join(g, len, e))) add(g, end);
+      if (g->count > g->max) break;
+      continue;
+    }
+
+    // directories to descend into are copied, as the listing may be
+    // dropped from the cache further down
+    {
+      size_t l = strlen(e) + 1;
+
+      if (used + l > size) {
+        char *p;
+
+        size = size ? size * 2 : 256;
+        while (used + l > size) size *= 2;
+
+        if (!(p = (char *)realloc(names, size))) break;
+        names = p;
+      }
+
+      memcpy(names + used, e, l);
+      used += l;
+    }
+  }
+
+  for (name = names; name < names + used; name += strlen(name) + 1) {
+    if (!(end = join(g, len, name))) continue;
+
+    if (s->type == GLOB_RECURSE) {
+      walk(g, seg, end, depth + 1);
+    } else {
+      walk(g, seg + 1, end, depth);
+    }
+  }
+
+  free(names);
+}
+
+static int compare(const void *a, const void *b) {
+  return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+/* Expand the wildcards of 'pattern', see parse_glob_t. */
+uint16_t glob_expand(const char *pattern, uint16_t max, parse_arena_t *a, char ***list) {
+  const char *s = pattern;
+  uint16_t i, n = 1, len = 0;
+  glob_t g;
+
+  for (i=0; pattern[i]; i++) {
+    if (pattern[i] == '/') n++;
+    if ((pattern[i] == '\\') && pattern[i + 1]) i++;
+  }
+
+  // one more for the '*' after a trailing '**'
+  g.seg   = (glob_seg_t *)parse_arena_alloc(a, (n + 1) * sizeof (glob_seg_t));
+  g.list  = (char **)parse_arena_alloc(a, max * sizeof (char *));
+  g.nseg  = 0;
+  g.slash = 0;
+  g.max   = max;
+  g.count = 0;
+  g.a     = a;
+
+  if (!g.seg || !g.list) return (0);
+
+  if (*s == '/') g.path[len++] = '/';
+
+  while (*s) {
+    const char *e = s;
+
+    while (*e && (*e != '/')) {
+      if ((*e == '\\') && e[1]) e++;
+      e++;
+    }
+
+    if (e > s) {
+      if (!compile(&g.seg[g.nseg++], s, e - s, a)) return (0);
+    }
+
+    if (*e && !e[1]) g.slash = 1;
+
+    s = *e ? e + 1 : e;
+  }
+
+  if (!g.nseg) return (0);
+
+  if (g.seg[g.nseg - 1].type == GLOB_RECURSE) {
+    if (!compile(&g.seg[g.nseg++], "*", 1, a)) return (0);
+  }
+
+  walk(&g, 0, len, 0);
+
+  if (g.count <= max) {
+    qsort(g.list, g.count, sizeof (char *), compare);
+    *list = g.list;
+  }
+
+  return (g.count);
+}
+
+#endif // HAVE_GLOB
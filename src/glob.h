@@ -0,0 +1,10 @@
+#ifndef _GLOB_H_
+#define _GLOB_H_
+
+#include <stdint.h>
+
+#include "parse.h"
+
+uint16_t glob_expand(const char *pattern, uint16_t max, parse_arena_t *a, char ***list);
+
+#endif // _GLOB_H_
@@ -0,0 +1,184 @@
+/* histfile.c -- history shared between concurrent push sessions.
+ *
+ * All sessions append the lines they execute to a common log file opened
+ * with O_APPEND. Every line is written as a single self-contained record
+ * with one write() call, so the kernel serializes concurrent appends and
+ * no locking is needed. Each session remembers how far it has read the
+ * log and picks up new records of other sessions with pread(), so readers
+ * never get in the way of writers.
+ *
+ * Record layout (little endian):
+ *
+ *   0x1e 'h' <len:2> <session:4> <sum:2> <line:len> '\n'
+ *
+ * A record that is still being written, or got damaged, is detected by
+ * its length or checksum. Readers then resync on the next record marker.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "lined.h"
+#include "histfile.h"
+
+#define HISTFILE_HEAD   10          // size of the record header
+#define HISTFILE_TAIL   (64 * 1024) // log tail loaded on startup
+
+static int      fd = -1;
+static off_t    offset = 0;
+static uint32_t session = 0;
+
+static lined_history_t *history = NULL; // where records are loaded into
+
+static uint16_t checksum(const uint8_t *buf, uint16_t len) {
+  uint16_t sum = 5381;
+
+  while (len--) sum = (sum << 5) + sum + *buf++;
+
+  return (sum);
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return (p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return (get16(p) | ((uint32_t)get16(p + 2) << 16));
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+/* Open (or create) the shared history log and load its tail into the
+ * history 'h', later records of other sessions are added by sync. Returns
+ * 0 on failure, sharing stays disabled then. */
+uint8_t histfile_open(const char *path, lined_history_t *h) {
+  struct stat st;
+
+  if (fd >= 0) return (1);
+
+  history = h;
+
+  fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+  if (fd < 0) return (0);
+
+  session = (uint32_t)getpid();
+
+  if (!fstat(fd, &st) && (st.st_size > HISTFILE_TAIL)) {
+    offset = st.st_size - HISTFILE_TAIL;
+  }
+
+  /* Our own records are skipped while syncing, so load the old ones
+   * with a session id nobody else uses. */
+  session = 0;
+  histfile_sync();
+  session = (uint32_t)getpid();
+
+  return (1);
+}
+
+void histfile_close(void) {
+  if (fd >= 0) close(fd);
+
+  fd = -1;
+  offset = 0;
+  history = NULL;
+}
+
+/* Append 'line' to the log as a single atomic record. */
+void histfile_append(const char *line) {
+  uint8_t rec[HISTFILE_HEAD + LINED_LENGTH + 1];
+  uint16_t len = (uint16_t)strlen(line);
+
+  if ((fd < 0) || !len || (len >= LINED_LENGTH)) return;
+
+  rec[0] = 0x1e;
+  rec[1] = 'h';
+  put16(rec + 2, len);
+  put16(rec + 4, session & 0xffff);
+  put16(rec + 6, session >> 16);
+  memcpy(rec + HISTFILE_HEAD, line, len);
+  put16(rec + 8, checksum(rec + HISTFILE_HEAD, len));
+  rec[HISTFILE_HEAD + len] = '\n';
+
+  if (write(fd, rec, HISTFILE_HEAD + len + 1) < 0) return;
+}
+
+/* Add all complete records appended since the last call, that have been
+ * written by other sessions, to the history. */
+void histfile_sync(void) {
+  uint8_t buf[1024];
+  uint16_t pos = 0, end = 0, want;
+  uint8_t more = 1; // the log may hold more than the buffer
+  uint8_t *mark;
+  ssize_t n;
+
+  if (fd < 0) return;
+
+  for (;;) {
+    uint16_t len;
+
+    /* Keep the incomplete record and refill the buffer. Once a read
+     * came back short, the end of the log is in the buffer. */
+    if (more && (end - pos < HISTFILE_HEAD + LINED_LENGTH + 1)) {
+      memmove(buf, buf + pos, end - pos);
+      end -= pos;
+      pos = 0;
+
+      want = sizeof (buf) - end;
+      n = pread(fd, buf + end, want, offset + end);
+      if (n > 0) end += n;
+      if (n < (ssize_t)want) more = 0;
+    }
+
+    if (end - pos < HISTFILE_HEAD + 1) break;
+
+    /* Resync on the next record marker in the buffer. */
+    if ((buf[pos] != 0x1e) || (buf[pos + 1] != 'h')) {
+      mark = memchr(buf + pos + 1, 0x1e, end - pos - 1);
+      len = mark ? (uint16_t)(mark - (buf + pos)) : end - pos;
+      pos += len; offset += len;
+      continue;
+    }
+
+    len = get16(buf + pos + 2);
+
+    if (len >= LINED_LENGTH) {
+      pos++; offset++;
+      continue;
+    }
+
+    /* Not completely written yet, read on or try again later. */
+    if (pos + HISTFILE_HEAD + len + 1 > end) {
+      if (!more) break;
+      continue;
+    }
+
+    if ((buf[pos + HISTFILE_HEAD + len] != '\n') ||
+        (get16(buf + pos + 8) != checksum(buf + pos + HISTFILE_HEAD, len))) {
+      pos++; offset++;
+      continue;
+    }
+
+    if (get32(buf + pos + 4) != session) {
+      char line[LINED_LENGTH];
+
+      memcpy(line, buf + pos + HISTFILE_HEAD, len);
+      line[len] = '\0';
+
+      lined_history_add(history, line);
+    }
+
+    pos    += HISTFILE_HEAD + len + 1;
+    offset += HISTFILE_HEAD + len + 1;
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef _HISTFILE_H_
+#define _HISTFILE_H_
+
+#include <stdint.h>
+
+#include "lined.h"
+
+uint8_t histfile_open(const char *path, lined_history_t *h);
+void    histfile_close(void);
+
+void    histfile_append(const char *line);
+void    histfile_sync(void);
+
+#endif // _HISTFILE_H_
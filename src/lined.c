@@ -138,23 +138,55 @@
 #include "lined.h"
 
 #ifdef HAVE_HISTORY
-static uint8_t history_max = 10; // default history length
-static uint8_t history_len = 0;  // current history length
-static char  **history = NULL;
+/* A history entry. Entries live in a fixed pool of slots and are never
+ * moved, instead they are linked from the oldest to the newest entry, so
+ * that a repeated line can be moved to the front in O(1). The hash chain
+ * links all entries sharing the same bucket of the dedupe index. */
+typedef struct history_t {
+  char    *line;  /* Heap allocated copy of the line. */
+  uint32_t stamp; /* History clock value of the last use. */
+  uint16_t uses;  /* Number of times the line has been added. */
+  uint16_t hash;  /* Hash value of the line. */
+  uint8_t  older; /* Slot of the next older entry. */
+  uint8_t  newer; /* Slot of the next newer entry. */
+  uint8_t  chain; /* Slot of the next entry in the same bucket. */
+} history_t;
+
+/* A history, it may be used by one or more lined instances. */
+struct lined_history_t {
+  uint8_t    max;    /* Maximum number of entries. */
+  uint8_t    len;    /* Current number of entries. */
+  uint8_t    mask;   /* Number of hash buckets - 1. */
+  uint8_t    oldest; /* Slot of the oldest entry. */
+  uint8_t    newest; /* Slot of the newest entry. */
+  uint8_t   *bucket; /* Dedupe index, first slot of each hash chain. */
+  uint8_t   *sorted; /* Prefix index, slots sorted by line. */
+  uint32_t   clock;  /* Stamp of the last added line. */
+  history_t *entry;  /* Entry pool. */
+#ifdef HAVE_HINTS
+  /* Tree over the prefix index, each node holds the newest slot below
+   * it, leaves start at 'len'. Rebuilt when the history changed. */
+  uint8_t   *recent;
+  uint32_t   recent_clock;
+  /* The last suggestion, it is still the most recent match as long as
+   * the buffer only grows and the history did not change. */
+  uint8_t    suggest_slot;
+  uint8_t    suggest_len;
+  uint32_t   suggest_clock;
+#endif
+};
 #endif
 
-/* Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-static void refresh_line(lined_t *l) {
-  uint8_t len = l->len;
-  uint8_t pos = l->pos;
-  char *buf = l->buf;
+/* Rewrite the currently edited line with the content of 'buf' and the
+ * cursor at 'pos', accordingly to the number of columns of the terminal. */
+static void refresh_buf(lined_t *l, char *buf, uint8_t len, uint8_t pos) {
+  uint8_t first = 0;
 
   if (!(l->flags & LINED_ECHO)) return;
 
   if (l->cols > 0) {
     while ((l->plen + pos) >= l->cols) {
-      buf++; len--; pos--;
+      first++; len--; pos--;
     }
     while ((l->plen + len) > l->cols) {
       len--;
@@ -163,121 +195,461 @@ static void refresh_line(lined_t *l) {
 
   l->xpos = pos;
 
-  term_refresh_line(l, buf, len);
+  term_refresh_line(l, buf, first, len);
+}
+
+#if defined(HAVE_HISTORY) && defined(HAVE_HINTS)
+static const char *history_suggest(lined_history_t *h, const char *buf, uint8_t len);
+#endif
+
+/* Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. With the
+ * cursor at the end of a new line, a matching history entry is offered
+ * as suggestion. */
+static void refresh_line(lined_t *l) {
+#if defined(HAVE_HISTORY) && defined(HAVE_HINTS)
+  l->suggest = NULL;
+
+  if ((l->flags & LINED_HINTS) && (l->flags & LINED_HISTORY) && l->history &&
+      (l->hist == LINED_HISTORY_NONE) && l->len && (l->pos == l->len)) {
+    l->suggest = history_suggest(l->history, l->buf, l->len);
+  }
+#endif
+
+  refresh_buf(l, l->buf, l->len, l->pos);
 }
 
 /* =============================== History ================================ */
 
 #ifdef HAVE_HISTORY
 
-/* Free the global history vector. */
-static void history_free(void) {
-  if (history) {
+/* Hash function (djb2) used for the dedupe index. */
+static uint16_t history_hash(const char *s) {
+  uint16_t h = 5381;
+
+  while (*s) h = (h << 5) + h + (uint8_t)*s++;
+
+  return (h);
+}
+
+/* Allocate the entry pool and the dedupe index for 'max' entries. The
+ * number of hash buckets is the next power of two, so that the average
+ * chain length stays below one, no matter how long the history is. */
+static uint8_t history_alloc(lined_history_t *h, uint8_t max) {
+  uint16_t buckets = 1;
+
+  while (buckets < max) buckets <<= 1;
+
+  h->entry = (history_t *)malloc(sizeof (history_t) * max);
+  h->bucket = (uint8_t *)malloc(buckets);
+  h->sorted = (uint8_t *)malloc(max);
+#ifdef HAVE_HINTS
+  h->recent = (uint8_t *)malloc(2 * max);
+  h->recent_clock = h->clock - 1;
+
+  if (!h->recent) {
+    free(h->sorted);
+    h->sorted = NULL;
+  }
+#endif
+
+  if (!h->entry || !h->bucket || !h->sorted) {
+    free(h->entry);
+    free(h->bucket);
+    free(h->sorted);
+    h->entry = NULL;
+    h->bucket = NULL;
+    h->sorted = NULL;
+#ifdef HAVE_HINTS
+    free(h->recent);
+    h->recent = NULL;
+#endif
+
+    return (0);
+  }
+
+  memset(h->bucket, LINED_HISTORY_NONE, buckets);
+
+  h->mask   = (uint8_t)(buckets - 1);
+  h->len    = 0;
+  h->oldest = LINED_HISTORY_NONE;
+  h->newest = LINED_HISTORY_NONE;
+
+  return (1);
+}
+
+/* Free all entries of history 'h'. */
+static void history_free(lined_history_t *h) {
+  if (h->entry) {
     uint8_t j;
 
-    for (j=0; j<history_len; j++) {
-      free(history[j]);
-      history[j] = NULL;
+    for (j=0; j<h->len; j++) {
+      free(h->entry[j].line);
     }
 
-    history_len = 0;
-    free(history);
-    history = NULL;
+    h->len = 0;
+    free(h->entry);
+    free(h->bucket);
+    free(h->sorted);
+    h->entry = NULL;
+    h->bucket = NULL;
+    h->sorted = NULL;
+#ifdef HAVE_HINTS
+    free(h->recent);
+    h->recent = NULL;
+#endif
+  }
+}
+
+/* Remove entry 'i' from the age list. */
+static void history_unlink(lined_history_t *h, uint8_t i) {
+  history_t *e = &h->entry[i];
+
+  if (e->older != LINED_HISTORY_NONE) {
+    h->entry[e->older].newer = e->newer;
+  } else {
+    h->oldest = e->newer;
+  }
+
+  if (e->newer != LINED_HISTORY_NONE) {
+    h->entry[e->newer].older = e->older;
+  } else {
+    h->newest = e->older;
   }
 }
 
+/* Link entry 'i' as the newest one. */
+static void history_link(lined_history_t *h, uint8_t i) {
+  h->entry[i].older = h->newest;
+  h->entry[i].newer = LINED_HISTORY_NONE;
+
+  if (h->newest != LINED_HISTORY_NONE) {
+    h->entry[h->newest].newer = i;
+  } else {
+    h->oldest = i;
+  }
+
+  h->newest = i;
+}
+
+/* Remove entry 'i' from its hash bucket. */
+static void history_unhash(lined_history_t *h, uint8_t i) {
+  uint8_t *p = &h->bucket[h->entry[i].hash & h->mask];
+
+  while (*p != i) p = &h->entry[*p].chain;
+
+  *p = h->entry[i].chain;
+}
+
+/* Find the slot holding 'line', LINED_HISTORY_NONE if there is none. */
+static uint8_t history_find(lined_history_t *h, const char *line, uint16_t hash) {
+  uint8_t i = h->bucket[hash & h->mask];
+
+  while (i != LINED_HISTORY_NONE) {
+    if ((h->entry[i].hash == hash) && !strcmp(h->entry[i].line, line)) break;
+
+    i = h->entry[i].chain;
+  }
+
+  return (i);
+}
+
+/* Binary search the first of the 'n' sorted entries whose line does not
+ * sort before the first 'len' characters of 's'. With 'len' including
+ * the terminating zero, this is the position of 's' itself. */
+static uint8_t history_lower(lined_history_t *h, const char *s, uint8_t len, uint8_t n) {
+  uint8_t lo = 0, mid;
+
+  while (lo < n) {
+    mid = lo + (n - lo) / 2;
+
+    if (strncmp(h->entry[h->sorted[mid]].line, s, len) < 0) {
+      lo = mid + 1;
+    } else {
+      n = mid;
+    }
+  }
+
+  return (lo);
+}
+
+#ifdef HAVE_HINTS
+/* Binary search the first of the 'n' sorted entries whose line sorts
+ * after the first 'len' characters of 's'. */
+static uint8_t history_upper(lined_history_t *h, const char *s, uint8_t len, uint8_t n) {
+  uint8_t lo = 0, mid;
+
+  while (lo < n) {
+    mid = lo + (n - lo) / 2;
+
+    if (strncmp(h->entry[h->sorted[mid]].line, s, len) <= 0) {
+      lo = mid + 1;
+    } else {
+      n = mid;
+    }
+  }
+
+  return (lo);
+}
+#endif
+
+/* Insert slot 'i' into the prefix index holding 'n' entries. */
+static void history_index_add(lined_history_t *h, uint8_t i, uint8_t n) {
+  const char *line = h->entry[i].line;
+  uint8_t p = history_lower(h, line, (uint8_t)strlen(line) + 1, n);
+
+  memmove(&h->sorted[p + 1], &h->sorted[p], n - p);
+  h->sorted[p] = i;
+}
+
+/* Remove slot 'i' from the prefix index holding 'n' entries. */
+static void history_index_del(lined_history_t *h, uint8_t i, uint8_t n) {
+  const char *line = h->entry[i].line;
+  uint8_t p = history_lower(h, line, (uint8_t)strlen(line) + 1, n);
+
+  memmove(&h->sorted[p], &h->sorted[p + 1], n - p - 1);
+}
+
+/* Store the heap allocated 'line' as the newest entry. If we reached the
+ * max length, the slot of the oldest entry is reused. */
+static uint8_t history_store(lined_history_t *h, char *line, uint16_t hash) {
+  uint8_t i, n;
+
+  if (h->len == h->max) {
+    i = h->oldest;
+    n = h->len - 1;
+
+    history_unlink(h, i);
+    history_unhash(h, i);
+    history_index_del(h, i, h->len);
+    free(h->entry[i].line);
+  } else {
+    i = n = h->len++;
+  }
+
+  h->entry[i].line  = line;
+  h->entry[i].hash  = hash;
+  h->entry[i].uses  = 0;
+  h->entry[i].chain = h->bucket[hash & h->mask];
+  h->bucket[hash & h->mask] = i;
+
+  history_link(h, i);
+  history_index_add(h, i, n);
+
+  return (i);
+}
+
+#ifdef HAVE_HINTS
+
+/* Returns the more recently used of slots 'a' and 'b'. */
+static uint8_t history_newer(lined_history_t *h, uint8_t a, uint8_t b) {
+  if (a == LINED_HISTORY_NONE) return (b);
+  if (b == LINED_HISTORY_NONE) return (a);
+
+  return ((h->entry[b].stamp > h->entry[a].stamp) ? b : a);
+}
+
+/* Returns the newest of the entries from 'lo' up to, but not including
+ * 'hi' in the prefix index, walking up the tree from both ends. */
+static uint8_t history_newest(lined_history_t *h, uint8_t lo, uint8_t hi) {
+  uint8_t *t = h->recent;
+  uint8_t i = LINED_HISTORY_NONE;
+  uint16_t l = lo + h->len, r = hi + h->len;
+
+  if (h->recent_clock != h->clock) {
+    memcpy(t + h->len, h->sorted, h->len);
+
+    for (i = h->len - 1; i > 0; i--) {
+      t[i] = history_newer(h, t[2 * i], t[2 * i + 1]);
+    }
+
+    h->recent_clock = h->clock;
+    i = LINED_HISTORY_NONE;
+  }
+
+  for (; l < r; l >>= 1, r >>= 1) {
+    if (l & 1) i = history_newer(h, i, t[l++]);
+    if (r & 1) i = history_newer(h, i, t[--r]);
+  }
+
+  return (i);
+}
+
+/* Returns the most recent entry that starts with, but is longer than the
+ * first 'len' characters of 'buf', or NULL if there is none. The entries
+ * sharing that prefix are adjacent in the index, two binary searches find
+ * the run and the tree over the index its newest entry. */
+static const char *history_suggest(lined_history_t *h, const char *buf, uint8_t len) {
+  uint8_t lo, hi, i = h->suggest_slot;
+
+  if (!h->len) return (NULL);
+
+  /* Typing on along the last suggestion doesn't change it. */
+  if ((i != LINED_HISTORY_NONE) && (h->suggest_clock == h->clock) &&
+      (len >= h->suggest_len) && !strncmp(h->entry[i].line, buf, len) &&
+      h->entry[i].line[len]) {
+    h->suggest_len = len;
+
+    return (h->entry[i].line);
+  }
+
+  lo = history_lower(h, buf, len, h->len);
+  hi = history_upper(h, buf, len, h->len);
+
+  // the line itself sorts before all longer ones
+  if ((lo < hi) && !h->entry[h->sorted[lo]].line[len]) lo++;
+
+  i = history_newest(h, lo, hi);
+
+  h->suggest_slot  = i;
+  h->suggest_len   = len;
+  h->suggest_clock = h->clock;
+
+  return ((i != LINED_HISTORY_NONE) ? h->entry[i].line : NULL);
+}
+
+#endif
+
 #endif
 
 /* ============================= Completion =============================== */
 
 #ifdef HAVE_COMPLETION
 
-/* Free a list of completion option populated by linedAddCompletion(). */
+#define COMPLETION_ARENA 256 // initial size of the candidate arena
+#define COMPLETION_CVEC  16  // initial size of the offset vector
+#define COMPLETION_MAX   ((completion_off_t)~0)
+
+/* Drop all candidates added by lined_completion_add(). */
 static void reset_completion(lined_t *l) {
-  if (l->lc) {
-    uint8_t i;
+  term_hide_menu(l);
 
-    for (i=0; i<l->lc->len; i++) free(l->lc->cvec[i]);
+  l->lc.busy  = 0;
+  l->lc.len   = 0;
+  l->lc.index = 0;
+  l->lc.used  = 0;
+}
 
-    free(l->lc->cvec);
+/* Grow the memory block at 'ptr' holding '*size' units of 'unit' bytes,
+ * until there is room for 'need' units. */
+static void *completion_grow(void *ptr, completion_off_t *size, completion_off_t need, uint8_t unit, uint16_t init) {
+  completion_off_t n = *size ? *size : init;
+
+  while (n < need) {
+    n = (n > COMPLETION_MAX / 2) ? COMPLETION_MAX : n * 2;
   }
 
-  free(l->lc);
-  l->lc = NULL;
-}
+#if SIZE_MAX < UINT32_MAX
+  // only an 8 bit target can't allocate 64K units
+  if ((uint32_t)n * unit > SIZE_MAX) return (NULL);
+#endif
 
-/* Show completion or original buffer */
-static void show_completion(lined_t *l) {
-  uint8_t i = l->lc->index;
+  ptr = realloc(ptr, (size_t)n * unit);
 
-  if (i < l->lc->len) {
-    lined_t saved;
+  if (ptr) *size = n;
 
-    memcpy(&saved, l, sizeof (lined_t));
-    strcpy(l->buf, l->lc->cvec[i]);
-    l->len = l->pos = strlen(l->buf);
+  return (ptr);
+}
 
-    refresh_line(l);
+/* Show completion or original buffer. The candidate is drawn straight
+ * from the arena, hints are only shown for the buffer itself. If there
+ * is more than one candidate, they are listed in a menu below. */
+static void show_completion(lined_t *l) {
+  uint16_t i = l->lc.index;
 
-    strcpy(l->buf, saved.buf);
-    l->len = saved.len;
-    l->pos = saved.pos;
+  if (i < l->lc.len) {
+    char *buf = l->lc.arena + l->lc.cvec[i];
+    uint8_t len = (uint8_t)strlen(buf);
+    uint8_t flags = l->flags;
+
+    l->flags &= ~LINED_HINTS;
+    refresh_buf(l, buf, len, len);
+    l->flags = flags;
   } else {
     refresh_line(l);
   }
+
+  /* Show all candidates, once they are complete. */
+  if (!l->lc.busy && (l->lc.len > 1) && (l->flags & LINED_ECHO)) {
+    term_show_menu(l);
+  }
+}
+
+/* Let the callback generate the next batch of candidates. The first one
+ * is shown as soon as it arrives, the menu when all are there. If there
+ * are none at all, we beep. */
+static void complete_step(lined_t *l) {
+  uint16_t len = l->lc.len;
+
+  l->lc.busy = l->cb.complete(l);
+
+  if (!l->lc.len) {
+    if (!l->lc.busy) term_make_beep();
+  } else if (!len || !l->lc.busy) {
+    show_completion(l);
+  }
 }
 
 /* This is an helper function for edit() and is called when the
  * user hits <tab> in order to complete the string currently in the
- * input buffer.
+ * input buffer. Candidates are generated by the complete callback in
+ * steps, the first one right here, the others by lined_idle(). Any
+ * other key stops the generation.
  *
  * The state of the editing is encapsulated into the pointed lined_t
  * structure as described in the structure definition. */
 static void complete_line(lined_t *l, uint8_t *c) {
-  uint8_t i;
+  uint16_t i;
+
+  if (!(l->flags & LINED_COMPLETE) || !l->cb.complete) return;
 
-  if (!(l->flags & LINED_COMPLETE)) return;
+  if (!l->lc.len && !l->lc.busy) {
+    if (*c != TERM_KEY_TAB) return;
 
-  if (!l->lc && (*c == TERM_KEY_TAB)) {
     *c = TERM_KEY_NONE;
 
-    // fill completion vector
-    lined_complete_cb(l);
+    // start filling the completion vector
+    l->lc.phase  = 0;
+    l->lc.cursor = 0;
+    l->lc.tag    = 0;
 
-    if (l->lc) {
-      show_completion(l);
-    } else {
-      term_make_beep();
-    }
+    complete_step(l);
 
     return;
   }
 
-  if (!l->lc) return;
+  if (*c != TERM_KEY_TAB) l->lc.busy = 0;
+
+  if (!l->lc.len) {
+    /* Nothing to show yet, wait for it or give up. */
+    if ((*c == TERM_KEY_TAB) || (*c == TERM_KEY_ESC)) *c = TERM_KEY_NONE;
 
-  i = l->lc->index;
+    return;
+  }
+
+  i = l->lc.index;
 
   if (*c == TERM_KEY_TAB) {
     *c = TERM_KEY_NONE;
 
     /* Increment completion index */
-    i = (i+1) % (l->lc->len+1);
-    if (i == l->lc->len) term_make_beep();
+    i = (i+1) % (l->lc.len+1);
+    if (i == l->lc.len) term_make_beep();
 
-    l->lc->index = i;
+    l->lc.index = i;
 
     show_completion(l);
   } else if (*c == TERM_KEY_ESC) {
     *c = TERM_KEY_NONE;
 
     /* Re-show original buffer */
-    if (i < l->lc->len) refresh_line(l);
+    if (i < l->lc.len) refresh_line(l);
 
     reset_completion(l);
   } else {
     /* Update buffer and return */
-    if (i < l->lc->len) {
-      strcpy(l->buf, l->lc->cvec[i]);
+    if (i < l->lc.len) {
+      strcpy(l->buf, l->lc.arena + l->lc.cvec[i]);
       l->len = l->pos = strlen(l->buf);
     }
 
@@ -344,26 +716,51 @@ static void edit_move_end(lined_t *l) {
 #ifdef HAVE_HISTORY
 
 /* Substitute the currently edited line with the next or previous history
- * entry as specified by 'dir'. */
+ * entry as specified by 'dir'. The line being edited is saved when we
+ * leave it and restored when we get back to it. */
 static void edit_history_next(lined_t *l, int8_t dir) {
-  int8_t last = (int8_t)history_len - 1;
+  lined_history_t *h = l->history;
+  uint8_t i = l->hist;
 
-  if ((l->flags & LINED_HISTORY) && last > 0) {
-    /* Update the current history entry before to
-     * overwrite it with the next one. */
-    free(history[last - l->index]);
-    history[last - l->index] = strdup(l->buf);
+  if (!(l->flags & LINED_HISTORY) || !h || !h->len) return;
 
-    /* Show the new entry, NOTE: direction is inverted */
-    if (((dir > 0) && (l->index > 0)) || (dir < 0) && (l->index < last)) {
-      l->index -= dir;
+  /* NOTE: direction is inverted */
+  if (dir < 0) {
+    i = (i == LINED_HISTORY_NONE) ? h->newest : h->entry[i].older;
+    if (i == LINED_HISTORY_NONE) return; // at the oldest entry
+  } else {
+    if (i == LINED_HISTORY_NONE) return; // at the edited line
+    i = h->entry[i].newer;
+  }
 
-      strcpy(l->buf, history[last - l->index]);
-      l->len = l->pos = strlen(l->buf);
+  if (l->hist == LINED_HISTORY_NONE) {
+    free(l->saved);
+    l->saved = strdup(l->buf);
+  }
 
-      refresh_line(l);
-    }
+  l->hist = i;
+
+  if (i != LINED_HISTORY_NONE) {
+    strcpy(l->buf, h->entry[i].line);
+  } else {
+    strcpy(l->buf, l->saved ? l->saved : "");
   }
+
+  l->len = l->pos = strlen(l->buf);
+
+  refresh_line(l);
+}
+
+#endif
+
+#if defined(HAVE_HISTORY) && defined(HAVE_HINTS)
+
+/* Take over the suggested history entry shown after the cursor. */
+static void edit_accept_suggest(lined_t *l) {
+  strcpy(l->buf, l->suggest);
+  l->len = l->pos = strlen(l->buf);
+
+  refresh_line(l);
 }
 
 #endif
@@ -427,12 +824,6 @@ static uint8_t edit_line(lined_t *l, uint8_t key) {
 #endif
 
   if (key == TERM_KEY_ENTER) {
-#ifdef HAVE_HISTORY
-    if (history_len > 0) {
-      free(history[--history_len]);
-    }
-#endif
-
 #ifdef HAVE_HINTS
     if (l->flags & LINED_HINTS) {
       /* Force a refresh without hints to leave the previous
@@ -444,7 +835,7 @@ static uint8_t edit_line(lined_t *l, uint8_t key) {
 #endif
 
 #ifdef HAVE_HISTORY
-    lined_history_add(l->buf);
+    lined_history_add(l->history, l->buf);
 #endif
 
     return (TERM_KEY_ENTER);
@@ -460,12 +851,6 @@ static uint8_t edit_line(lined_t *l, uint8_t key) {
     if (l->len > 0) {
       edit_delete(l);
     } else {
-#ifdef HAVE_HISTORY
-      if (history_len > 0) {
-        free(history[--history_len]);
-      }
-#endif
-
       return (TERM_KEY_CTRL_D);
     }
   } else if (key == TERM_KEY_CTRL_T) {
@@ -481,6 +866,12 @@ static uint8_t edit_line(lined_t *l, uint8_t key) {
     }
   } else if (key == TERM_KEY_CTRL_B) {
     edit_move_left(l);
+#if defined(HAVE_HISTORY) && defined(HAVE_HINTS)
+  } else if (((key == TERM_KEY_CTRL_F) || (key == TERM_KEY_CTRL_E)) &&
+             l->suggest) {
+    /* accept the suggestion */
+    edit_accept_suggest(l);
+#endif
   } else if (key == TERM_KEY_CTRL_F) {
     edit_move_right(l);
 #ifdef HAVE_HISTORY
@@ -523,8 +914,9 @@ static uint8_t edit_line(lined_t *l, uint8_t key) {
 
 /* ============================= lined API ================================ */
 
-/* The high level function that creates a new lined context. */
-lined_t *lined_init(void) {
+/* The high level function that creates a new lined context, using the
+ * callbacks 'cb' and lines of 'history'. Both may be NULL. */
+lined_t *lined_init(const lined_cb_t *cb, lined_history_t *history) {
   lined_t *l = (lined_t *)malloc(sizeof (lined_t));
 
   if (!l) return (NULL);
@@ -533,6 +925,17 @@ lined_t *lined_init(void) {
    * specific editing functionalities. */
   memset(l, 0, sizeof (lined_t));
   l->flags = 0x0f;
+#ifdef HAVE_HISTORY
+  l->history = history;
+  l->hist    = LINED_HISTORY_NONE;
+#endif
+
+  if (cb) l->cb = *cb;
+
+  if (!term_open(l)) {
+    free(l);
+    return (NULL);
+  }
 
   term_screen_size(&l->cols, &l->rows);
 
@@ -541,10 +944,10 @@ lined_t *lined_init(void) {
 
 void lined_reset(lined_t *l, uint8_t flags) {
 #ifdef HAVE_HISTORY
-  /* The latest history entry is always our current buffer, that
-   * initially is just an empty string. */
-  lined_history_add("");
-  l->index = 0;
+  /* Start editing a new line, that is not part of the history yet. */
+  free(l->saved);
+  l->saved = NULL;
+  l->hist  = LINED_HISTORY_NONE;
 #endif
 
 #ifdef HAVE_COMPLETION
@@ -580,14 +983,30 @@ void lined_edit(lined_t *l, uint8_t key) {
   edit_line(l, key);
 }
 
+/* To be called while no key is pending, does background work like the
+ * generation of completion candidates. Returns non zero, as long as there
+ * is more work to do. */
+uint8_t lined_idle(lined_t *l) {
+#ifdef HAVE_COMPLETION
+  if (l->lc.busy) complete_step(l);
+
+  return (l->lc.busy);
+#else
+  return (0);
+#endif
+}
+
 void lined_fini(lined_t *l) {
 #ifdef HAVE_COMPLETION
-  reset_completion(l);
+  free(l->lc.arena);
+  free(l->lc.cvec);
 #endif
 #ifdef HAVE_HISTORY
-  //history_free();
+  free(l->saved);
 #endif
 
+  term_close(l);
+
   free(l);
 }
 
@@ -598,72 +1017,117 @@ void lined_fini(lined_t *l) {
  * user hit <tab>. */
 void lined_completion_add(lined_t *l, const char *str) {
 #ifdef HAVE_COMPLETION
-  uint8_t len = strlen(str);
-  char *copy, **cvec;
+  completion_t *lc = &l->lc;
+  size_t len = strlen(str) + 1;
+
+  /* Must fit into the line buffer, when selected. */
+  if (len > LINED_LENGTH) return;
+
+  if (len > (size_t)(lc->size - lc->used)) {
+    char *arena;
 
-  if (!l->lc) {
-    l->lc = (completion_t *)malloc(sizeof (completion_t));
+    if (len > (size_t)(COMPLETION_MAX - lc->used)) return;
 
-    l->lc->len   = 0;
-    l->lc->index = 0;
-    l->lc->cvec  = NULL;
+    arena = (char *)completion_grow(lc->arena, &lc->size,
+      lc->used + len, sizeof (char), COMPLETION_ARENA);
+
+    if (arena == NULL) return;
+
+    lc->arena = arena;
   }
 
-  copy = (char *)malloc(len + 1);
+  if (lc->len == lc->max) {
+    completion_off_t *cvec;
 
-  if (copy == NULL) return;
+    if (lc->len == UINT16_MAX) return;
 
-  memcpy(copy, str, len + 1);
-  cvec = (char **)realloc(l->lc->cvec, sizeof (char *) * (l->lc->len + 1));
+    cvec = (completion_off_t *)completion_grow(lc->cvec, &lc->max,
+      lc->len + 1, sizeof (completion_off_t), COMPLETION_CVEC);
 
-  if (cvec == NULL) {
-    free(copy);
-    return;
+    if (cvec == NULL) return;
+
+    lc->cvec = cvec;
   }
 
-  l->lc->cvec = cvec;
-  l->lc->cvec[l->lc->len++] = copy;
+  memcpy(lc->arena + lc->used, str, len);
+  lc->cvec[lc->len++] = lc->used;
+  lc->used += len;
 #endif
 }
 
 /* =============================== History ================================ */
 
 
-/* This is the API call to add a new entry in the lined history.
- * It uses a fixed array of char pointers that are shifted (memmoved)
- * when the history max length is reached in order to remove the older
- * entry and make room for the new one, so it is not exactly suitable
- * for huge histories, but will work well for a few hundred of entries. */
-void lined_history_add(const char *line) {
+/* Create an empty history for up to 'len' lines. It may be used by any
+ * number of lined instances, every instance may have its own. */
+lined_history_t *lined_history_init(uint8_t len) {
 #ifdef HAVE_HISTORY
-  char *copy = NULL;
+  lined_history_t *h = (lined_history_t *)malloc(sizeof (lined_history_t));
 
-  if (history_max == 0) return;
+  if (!h) return (NULL);
 
-  /* Initialization on first call. */
-  if (history == NULL) {
-    history = (char **)malloc(sizeof (char *) * history_max);
+  memset(h, 0, sizeof (lined_history_t));
+
+  /* The highest slot number marks the end of lists. */
+  if (len == LINED_HISTORY_NONE) len--;
 
-    if (history == NULL) return;
+  h->max    = len;
+  h->oldest = LINED_HISTORY_NONE;
+  h->newest = LINED_HISTORY_NONE;
+#ifdef HAVE_HINTS
+  h->suggest_slot = LINED_HISTORY_NONE;
+#endif
 
-    memset(history, 0, (sizeof (char *) * history_max));
+  return (h);
+#else
+  (void)len;
+
+  return (NULL);
+#endif
+}
+
+/* Free history 'h' with all its lines. */
+void lined_history_fini(lined_history_t *h) {
+#ifdef HAVE_HISTORY
+  if (!h) return;
+
+  history_free(h);
+  free(h);
+#endif
+}
+
+/* This is the API call to add a new entry in the lined history.
+ * Lines already in the history are found through a hash index and moved
+ * to the front instead of being added again, bumping their use count and
+ * time stamp. Empty lines are not added at all. */
+void lined_history_add(lined_history_t *h, const char *line) {
+#ifdef HAVE_HISTORY
+  uint16_t hash;
+  uint8_t i;
+
+  if (!h || h->max == 0 || !*line) return;
+
+  /* Initialization on first call. */
+  if (h->entry == NULL) {
+    if (!history_alloc(h, h->max)) return;
   }
 
-  /* Don't add duplicates. */
-  if (history_len && !strcmp(history[history_len-1], line)) return;
+  hash = history_hash(line);
+  i = history_find(h, line, hash);
 
-  /* Add an heap allocated copy of the line in the history.
-   * If we reached the max length, remove the older line. */
+  if (i == LINED_HISTORY_NONE) {
+    char *copy = strdup(line);
 
-  if (!(copy = strdup(line))) return;
+    if (!copy) return;
 
-  if (history_len == history_max) {
-    free(history[0]);
-    memmove(history, history+1, sizeof (char *) * (history_max-1));
-    history_len--;
+    i = history_store(h, copy, hash);
+  } else {
+    history_unlink(h, i);
+    history_link(h, i);
   }
 
-  history[history_len++] = copy;
+  if (h->entry[i].uses < UINT16_MAX) h->entry[i].uses++;
+  h->entry[i].stamp = ++h->clock;
 #endif
 }
 
@@ -671,37 +1135,78 @@ void lined_history_add(const char *line) {
  * if there is already some history, the function will make sure to retain
  * just the latest 'len' elements if the new history length value is smaller
  * than the amount of items already inside the history. */
-void lined_history_len(uint8_t len) {
+void lined_history_len(lined_history_t *h, uint8_t len) {
 #ifdef HAVE_HISTORY
-  if (len < 1) return;
+  if (!h || len < 1) return;
+
+  /* The highest slot number marks the end of lists. */
+  if (len == LINED_HISTORY_NONE) len--;
+
+  if (h->entry) {
+    history_t *old = h->entry;
+    uint8_t *bucket = h->bucket;
+    uint8_t *sorted = h->sorted;
+#ifdef HAVE_HINTS
+    uint8_t *recent = h->recent;
+#endif
+    uint8_t i = h->oldest, skip = 0;
 
-  if (history) {
-    uint8_t tocopy = history_len;
+    if (h->len > len) skip = h->len - len;
 
-    char **n = (char **)malloc(sizeof (char *) * len);
+    if (!history_alloc(h, len)) {
+      h->entry = old;
+      h->bucket = bucket;
+      h->sorted = sorted;
+#ifdef HAVE_HINTS
+      h->recent = recent;
+#endif
+      return;
+    }
 
-    if (n == NULL) return;
+    h->max = len;
 
-    /* If we can't copy everything, free the elements we'll not use. */
-    if (len < tocopy) {
-      uint8_t j;
+    /* Move the latest entries over, oldest first, to keep the order. If
+     * we can't copy everything, free the elements we'll not use. */
+    while (i != LINED_HISTORY_NONE) {
+      history_t *e = &old[i];
 
-      for (j=0; j<tocopy-len; j++) {
-        free(history[j]);
+      if (skip) {
+        skip--;
+        free(e->line);
+      } else {
+        uint8_t j = history_store(h, e->line, e->hash);
+
+        h->entry[j].uses  = e->uses;
+        h->entry[j].stamp = e->stamp;
       }
 
-      tocopy = len;
+      i = e->newer;
     }
 
-    memset(n, 0, sizeof (char *) * len);
-    memcpy(n, history + (history_len - tocopy), sizeof (char *) * tocopy);
-    free(history);
-    history = n;
+    free(old);
+    free(bucket);
+    free(sorted);
+#ifdef HAVE_HINTS
+    free(recent);
+#endif
+
+    h->clock++; // slots moved, drop cached lookups
   }
 
-  history_max = len;
-  if (history_len > history_max) {
-    history_len = history_max;
+  h->max = len;
+#endif
+}
+
+/* Returns the history entry 'i' and its use count, or NULL if there are
+ * less entries. Entries are not returned in any particular order. */
+const char *lined_history_get(lined_history_t *h, uint8_t i, uint16_t *uses) {
+#ifdef HAVE_HISTORY
+  if (h && (i < h->len)) {
+    if (uses) *uses = h->entry[i].uses;
+
+    return (h->entry[i].line);
   }
 #endif
+
+  return (NULL);
 }
@@ -46,18 +46,62 @@
 #define LINED_HISTORY  (1<<2) /* Enable history browsing while editing. */
 #define LINED_COMPLETE (1<<3) /* TAB completion is enabled for editing. */
 
+#define LINED_HISTORY_NONE 0xff /* Not browsing the history. */
+
 #ifdef HAVE_COMPLETION
+/* Offset into the candidate arena, long listings need more than 64K. */
+#ifdef POSIX
+typedef uint32_t completion_off_t;
+#else
+typedef uint16_t completion_off_t;
+#endif
+
+/* The TAB completion candidates. The strings are stored back to back in a
+ * bump arena and referenced by their offset, so that the whole set can be
+ * dropped at once. Arena and offset vector are kept for the next TAB. */
 typedef struct completion_t {
-  uint8_t len;
-  uint8_t index;
-  char **cvec;
+  uint16_t  len;             /* Number of candidates. */
+  uint16_t  index;           /* Candidate currently shown. */
+  completion_off_t  max;     /* Capacity of the offset vector. */
+  completion_off_t  used;    /* Bytes used in the arena. */
+  completion_off_t  size;    /* Size of the arena. */
+  completion_off_t *cvec;    /* Offsets of the candidates in the arena. */
+  char     *arena;           /* Candidate strings. */
+  uint8_t   busy;            /* More candidates are being generated. */
+  uint8_t   phase;           /* Generator state, owned by the callback. */
+  uint32_t  cursor;          /* Generator position, owned by the callback. */
+  uint32_t  tag;             /* Generator source, owned by the callback. */
 } completion_t;
 #endif
 
+typedef struct lined_t lined_t;
+
+/* A history of edited lines, see lined_history_init(). */
+typedef struct lined_history_t lined_history_t;
+
+/* The terminal state of an instance, owned by term.c. */
+typedef struct term_t term_t;
+
+/* The callbacks of an instance, given to lined_init(). Any of them may
+ * be NULL. The 'ctx' member of lined_t is left to them. */
+typedef struct lined_cb_t {
+  /* Add completion candidates, returns non zero while there are more. */
+  uint8_t     (*complete)(lined_t *l);
+  /* Returns the hint shown after the edited line, or NULL. */
+  const char *(*hint)(lined_t *l);
+  /* Returns non zero if the first 'len' characters of 'name' are a
+   * known command, used for highlighting. */
+  uint8_t     (*command)(lined_t *l, const char *name, uint8_t len);
+  /* Returns a number that changes whenever the known commands do, so
+   * that the highlighting is done again. */
+  uint32_t    (*commands)(lined_t *l);
+} lined_cb_t;
+
 /* The lined_t structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
- * functionalities. */
-typedef struct lined_t {
+ * functionalities. Everything an instance needs lives in here, so
+ * any number of instances can be driven at the same time. */
+struct lined_t {
   char    buf[LINED_LENGTH]; /* Edited line buffer. */
   uint8_t pos;               /* Current cursor position in buf. */
   uint8_t len;               /* Current edited line length. */
@@ -68,27 +112,39 @@ typedef struct lined_t {
   uint8_t plen;              /* Prompt length. */
   uint8_t key;               /* Last pressed key. */
 #ifdef HAVE_COMPLETION
-  completion_t *lc;          /* Current TAB completion vector. */
+  completion_t lc;           /* Current TAB completion vector. */
 #endif
 #ifdef HAVE_HISTORY
-  int8_t index;              /* The history index we are currently editing. */
+  lined_history_t *history;  /* History used by this instance, or NULL. */
+  uint8_t hist;              /* The history slot we are currently showing. */
+  char   *saved;             /* Edited line, saved while browsing history. */
+#ifdef HAVE_HINTS
+  const char *suggest;       /* History entry suggested for the line. */
+#endif
 #endif
   const char *prompt;        /* Prompt to display. */
-} lined_t;
+  lined_cb_t  cb;            /* Callbacks. */
+  term_t     *term;          /* Terminal state. */
+  void       *ctx;           /* Context of the callbacks. */
+};
 
-lined_t *lined_init(void);
+lined_t *lined_init(const lined_cb_t *cb, lined_history_t *history);
 char    *lined_line(lined_t *l);
 void     lined_fini(lined_t *l);
 
 void     lined_edit(lined_t *l, uint8_t key);
+uint8_t  lined_idle(lined_t *l);
 void     lined_resize(lined_t *l, uint8_t w, uint8_t h);
 void     lined_prompt(lined_t *l, const char *prompt);
 void     lined_reset(lined_t *l, uint8_t flags);
 
 void     lined_completion_add(lined_t *l, const char *str);
-void     lined_history_add(const char *line);
-void     lined_history_len(uint8_t len);
 
-extern void lined_complete_cb(lined_t *l);
+lined_history_t *lined_history_init(uint8_t len);
+void     lined_history_fini(lined_history_t *h);
+void     lined_history_add(lined_history_t *h, const char *line);
+void     lined_history_len(lined_history_t *h, uint8_t len);
+
+const char *lined_history_get(lined_history_t *h, uint8_t i, uint16_t *uses);
 
 #endif // _LINED_H_
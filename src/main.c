@@ -7,6 +7,22 @@
 #include "term.h"
 #include "cli.h"
 
+#ifdef HAVE_SHARED_HISTORY
+#include "histfile.h"
+#endif
+
+#ifdef HAVE_SERVER
+#include "server.h"
+#endif
+
+#ifdef HAVE_SCRIPT
+#include "script.h"
+#endif
+
+#ifdef HAVE_VARS
+#include "var.h"
+#endif
+
 #include "push.h"
 
 char scratch[SCRATCH_SIZE];
@@ -15,11 +31,61 @@ char scratch[SCRATCH_SIZE];
 static uint8_t reset_once_after_startup = 1;
 #endif
 
+#ifdef HAVE_SCRIPT
+int main(int argc, char **argv) {
+#else
 int main(void) {
+#endif
+  lined_history_t *history;
   lined_t *lined;
   uint8_t logout;
   uint8_t restart;
 
+#ifdef HAVE_VARS
+  // variables survive a reset, like the history
+  var_init();
+#endif
+
+#ifdef HAVE_SCRIPT
+  // run a script, without the terminal
+  if (argc > 1) {
+    cli_init();
+    script_source(argc - 1, argv + 1);
+    cli_fini();
+
+#ifdef HAVE_VARS
+    var_fini();
+#endif
+
+    fflush(stdout);
+
+    return (cli_status());
+  }
+#endif
+
+#ifdef HAVE_SERVER
+  // serve sessions on a unix socket, instead of the terminal
+  if (getenv("PUSH_SERVER")) {
+    uint8_t ret = server_run(getenv("PUSH_SERVER"));
+
+#ifdef HAVE_VARS
+    var_fini();
+#endif
+
+    return (ret);
+  }
+#endif
+
+  // the history survives a reset
+  history = lined_history_init(10);
+
+#ifdef HAVE_SHARED_HISTORY
+  // opt-in history shared with other sessions
+  if (getenv("PUSH_HISTFILE")) {
+    histfile_open(getenv("PUSH_HISTFILE"), history);
+  }
+#endif
+
 loop:
 
   lined   = NULL;
@@ -40,10 +106,12 @@ loop:
 
   term_clear_screen();
 
-  if (!(lined = lined_init())) {
+  if (!(lined = lined_init(&cli_cb, history))) {
     printf("push: out of memory\n"); return (1);
   }
 
+  cli_init();
+
   textcolor(COLOR_CYAN);
   printf(
     "       ____  __  _______ __  __\n"
@@ -60,41 +128,43 @@ loop:
   lined_reset(lined, LINED_HISTORY | LINED_COMPLETE | LINED_HINTS | LINED_ECHO);
 
   while (!logout) {
-    uint8_t key = term_get_key(lined);
+    uint8_t key, ret;
 
-    lined_edit(lined, key);
-
-    if (key == TERM_KEY_ENTER) {
-      //char *cmd = lined_line(lined);
-      char *cmd = lined->buf;
-      uint8_t ret;
-
-      printf("\n");
+#ifdef HAVE_COMPLETION
+    // generate completion candidates, until a key is pressed
+    while (lined_idle(lined) && !term_key_ready(lined));
+#endif
 
-      ret = cli_exec(cmd);
+    key = term_get_key(lined);
 
-      if (ret == 1) {
-        logout = 1;
-      } else if (ret == 2) {
-        restart = 1; // reset
-        logout = 1;
-      }
+    ret = cli_input(lined, key);
 
-      lined_reset(lined, LINED_HISTORY | LINED_COMPLETE | LINED_HINTS | LINED_ECHO);
-    } else if (key == TERM_KEY_CTRL_C) {
-      printf("break\n");
+    if (ret == 1) {
       logout = 1;
-    } else if (key == TERM_KEY_CTRL_D) {
-      printf("exit\n");
+    } else if (ret == 2) {
+      restart = 1; // reset
       logout = 1;
     }
   }
 
+  cli_fini();
+  cli_release(lined);
+
   lined_fini(lined);
 
   term_fini();
 
   if (restart) goto loop;
 
+#ifdef HAVE_SHARED_HISTORY
+  histfile_close();
+#endif
+
+  lined_history_fini(history);
+
+#ifdef HAVE_VARS
+  var_fini();
+#endif
+
   return (0);
 }
@@ -4,169 +4,668 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "parse.h"
 #include "push.h"
 
-uint8_t parse_opterr = 1,  /* if error message should be printed */
-        parse_optind = 1,  /* index into parent argv vector */
-        parse_optopt,      /* character checked for validity */
-        parse_optreset;    /* reset getopt */
+/* Start allocating from the 'size' bytes at 'buf', which must be aligned
+ * for pointers. Once they are used up, blocks are taken from the heap. */
+void parse_arena_init(parse_arena_t *a, void *buf, uint16_t size) {
+  a->ptr  = (char *)buf;
+  a->left = size;
+  a->heap = NULL;
+}
+
+void *parse_arena_alloc(parse_arena_t *a, uint16_t size) {
+  void *ptr;
+
+  // keep pointers aligned
+  size = (size + sizeof (char *) - 1) & ~(sizeof (char *) - 1);
+
+  if (size > a->left) {
+    uint16_t block = (size > PARSE_BLOCK) ? size : PARSE_BLOCK;
+    char *b = (char *)malloc(sizeof (char *) + block);
+
+    if (!b) return (NULL);
+
+    *(char **)b = (char *)a->heap;
+    a->heap = b;
+    a->ptr  = b + sizeof (char *);
+    a->left = block;
+  }
+
+  ptr = a->ptr;
+  a->ptr  += size;
+  a->left -= size;
+
+  return (ptr);
+}
+
+/* Free the heap blocks of the arena, the caller's buffer stays. */
+void parse_arena_free(parse_arena_t *a) {
+  while (a->heap) {
+    char *next = *(char **)a->heap;
+
+    free(a->heap);
+    a->heap = next;
+  }
+
+  a->left = 0;
+}
+
+static parse_lookup_t lookup = NULL; // variable lookup for expansions
+static parse_glob_t   glob   = NULL; // wildcard expansion
+static parse_arith_t  arith  = NULL; // arithmetic expansion
+static uint8_t        broken = 0;    // an expansion failed
 
-char *parse_optarg;        /* argument associated with option */
+/* Operators, as they appear in argument vectors. */
+const char parse_ops[PARSE_OPS][4] = { "|", ">", ">>", "<", "2>", "2>>" };
 
-#define  BADCH  '?'
-#define  BADARG ':'
-#define  EMSG   ""
+/* Returns the length of the operator at 's', which is stored in 'op', or
+ * 0 if there is none. */
+static uint8_t operator(const char *s, uint8_t *op) {
+  uint8_t fd = 0;
 
-uint8_t parse_getopt(uint8_t nargc, char **nargv, const char *ostr) {
-  static char *place = EMSG;       /* option letter processing */
-  char *oli;                       /* option letter list index */
+  if ((s[0] == '2') && (s[1] == '>')) fd = 1;
 
-  if (parse_optreset) {            /* reset scanning pointer */
-    parse_optreset = 0;
-    parse_optind = 1;
+  switch (s[fd]) {
+    case '|': *op = PARSE_OP_PIPE; return (1);
+    case '<': *op = PARSE_OP_IN;   return (1);
+    case '>':
+      if (s[fd + 1] == '>') {
+        *op = fd ? PARSE_OP_ERR_APPEND : PARSE_OP_APPEND;
+        return (fd + 2);
+      }
 
-    place = EMSG;
+      *op = fd ? PARSE_OP_ERR : PARSE_OP_OUT;
+      return (fd + 1);
   }
 
-  if (!*place) {                   /* update scanning pointer */
-    if (parse_optind >= nargc || *(place = nargv[parse_optind]) != '-') {
-      place = EMSG;
+  return (0);
+}
+
+/* Returns the operator 'word' of an argument vector stands for, or
+ * PARSE_OP_NONE if it's a word. */
+uint8_t parse_op(const char *word) {
+  uint8_t i;
 
-      return (255);
+  for (i=0; i<PARSE_OPS; i++) {
+    if (word == parse_ops[i]) return (i);
+  }
+
+  return (PARSE_OP_NONE);
+}
+
+/* Returns the length of the arithmetic expansion '$((...))' at 's', with
+ * at most 'len' characters, 0 if there is none or it isn't closed. */
+static uint16_t arith_span(const char *s, uint16_t len) {
+  uint16_t i;
+  uint8_t depth = 2;
+
+  if ((len < 5) || (s[0] != '$') || (s[1] != '(') || (s[2] != '(')) return (0);
+
+  for (i=3; (i < len) && s[i]; i++) {
+    if (s[i] == '(') {
+      if (++depth == 0) return (0);
+    } else if ((s[i] == ')') && !--depth) {
+      return (i + 1);
     }
+  }
 
-    if (place[1] && *++place == '-') { /* found "--" */
-      ++parse_optind;
-      place = EMSG;
+  return (0);
+}
+
+/* Find the next word of 'line' from '*pos' on, and advance '*pos' to the
+ * end of it. A word runs up to the next blank or operator outside of
+ * quotes, an operator is a word of its own. Single quotes take everything
+ * literally, in double quotes and outside of quotes a backslash escapes
+ * the next character, an arithmetic expansion is taken as a whole.
+ * Returns 0, if there is no word left. */
+uint8_t parse_word(const char *line, uint16_t *pos, parse_span_t *span) {
+  uint16_t i = *pos, n;
+  char quote = 0;
+
+  while ((line[i] == ' ') || (line[i] == '\t')) i++;
+
+  if (!line[i]) {
+    *pos = i;
+    return (0);
+  }
 
-      return (255);
+  span->off   = i;
+  span->flags = 0;
+
+  if ((span->len = operator(line + i, &span->op))) {
+    span->flags = PARSE_OPERATOR;
+    *pos = i + span->len;
+
+    return (1);
+  }
+
+  if (line[i] == '~') span->flags |= PARSE_EXPAND;
+
+  for (; line[i]; i++) {
+    char c = line[i];
+
+    if (quote) {
+      if (c == quote) {
+        quote = 0;
+      } else if ((c == '\\') && (quote == '"') && line[i + 1]) {
+        span->flags |= PARSE_ESCAPED;
+        i++;
+      } else if ((c == '$') && (quote == '"')) {
+        span->flags |= PARSE_EXPAND;
+        if ((n = arith_span(line + i, 0xffff))) i += n - 1;
+      }
+    } else if (c == '$') {
+      span->flags |= PARSE_EXPAND;
+      if ((n = arith_span(line + i, 0xffff))) i += n - 1;
+    } else if ((c == '*') || (c == '?') || (c == '[')) {
+      span->flags |= PARSE_GLOB;
+    } else if ((c == ' ') || (c == '\t') || (c == '|') || (c == '<') || (c == '>')) {
+      break;
+    } else if ((c == '"') || (c == '\'')) {
+      span->flags |= PARSE_QUOTED;
+      quote = c;
+    } else if ((c == '\\') && line[i + 1]) {
+      span->flags |= PARSE_ESCAPED;
+      i++;
     }
-  }                                /* option letter okay? */
+  }
+
+  span->len = i - span->off;
+  *pos = i;
 
-  if ((parse_optopt = *place++) == ':' || !(oli = strchr(ostr, parse_optopt))) {
-    /* if the user didn't specify '-' as an option, assume it means -1. */
-    if (parse_optopt == '-') return (255);
+  return (1);
+}
+
+#ifdef HAVE_EXEC
+
+/* Words that start a compound command of sh. */
+static const char *const keywords[] = {
+  "!", "{", "[[", "case", "for", "if", "select", "until", "while", NULL
+};
+
+/* Returns non-zero, if 'line' uses syntax of sh that push doesn't know:
+ * lists with ';', '&&' or '||', background jobs, subshells, command
+ * substitution, here documents, redirections of descriptors like '2>&1',
+ * compound commands or assignments in front of a command. Quotes are
+ * respected like parse_word() does. */
+uint8_t parse_shell(const char *line) {
+  const char *const *k;
+  parse_span_t span;
+  uint16_t i, n;
+  char quote = 0;
+
+  i = 0;
 
-    if (!*place) ++parse_optind;
+  if (parse_word(line, &i, &span) && !(span.flags & PARSE_OPERATOR)) {
+    const char *w = line + span.off;
 
-    if (parse_opterr && *ostr != ':') {
-      printf("illegal option -- %c\n",  parse_optopt);
+    for (k = keywords; *k; k++) {
+      if ((strlen(*k) == span.len) && !strncmp(*k, w, span.len)) return (1);
     }
 
-    return (BADCH);
+    // NAME=value followed by a command
+    for (n=0; n<span.len; n++) {
+      char c = w[n];
+
+      if ((c != '_') && !((c >= 'a') && (c <= 'z')) && !((c >= 'A') && (c <= 'Z')) &&
+          !(n && (c >= '0') && (c <= '9'))) break;
+    }
+
+    if (n && (n < span.len) && (w[n] == '=') && parse_word(line, &i, &span)) return (1);
+  }
+
+  for (i=0; line[i]; i++) {
+    char c = line[i];
+
+    if (quote == '\'') {
+      if (c == quote) quote = 0;
+    } else if ((c == '\\') && line[i + 1]) {
+      i++;
+    } else if (c == '`') {
+      return (1);
+    } else if ((c == '$') && (line[i + 1] == '(')) {
+      if (!(n = arith_span(line + i, 0xffff))) return (1);
+      i += n - 1;
+    } else if (quote) {
+      if (c == quote) quote = 0;
+    } else if ((c == '"') || (c == '\'')) {
+      quote = c;
+    } else if ((c == ';') || (c == '&') || (c == '(') || (c == ')')) {
+      return (1);
+    } else if (((c == '|') || (c == '<')) && (line[i + 1] == c)) {
+      return (1);
+    }
   }
 
-  if (*++oli != ':') {             /* don't need argument */
-    parse_optarg = NULL;
+  return (0);
+}
+
+#endif // HAVE_EXEC
 
-    if (!*place) ++parse_optind;
-  } else {                         /* need an argument */
-    if (*place) {                  /* no white space */
-      parse_optarg = place;
-    } else if (nargc <= ++parse_optind) {  /* no arg */
-      place = EMSG;
+/* Copy the 'len' characters of the word at 'src' to 'dst' with quotes and
+ * escapes removed. The text only shrinks, so 'dst' may be 'src'. Returns
+ * the length of the result, which is not terminated. */
+uint16_t parse_unquote(char *dst, const char *src, uint16_t len) {
+  uint16_t i, n = 0;
+  char quote = 0;
 
-      if (*ostr == ':') return (BADARG);
+  for (i=0; i<len; i++) {
+    char c = src[i];
 
-      if (parse_opterr) {
-        printf("option requires an argument -- %c\n", parse_optopt);
+    if (quote) {
+      if (c == quote) {
+        quote = 0;
+        continue;
       }
 
-      return (BADCH);
-    } else {                       /* white space */
-      parse_optarg = nargv[parse_optind];
+      if ((c == '\\') && (quote == '"') && (i + 1 < len) &&
+          strchr("\"\\$`", src[i + 1])) {
+        c = src[++i];
+      }
+    } else if ((c == '"') || (c == '\'')) {
+      quote = c;
+      continue;
+    } else if ((c == '\\') && (i + 1 < len)) {
+      c = src[++i];
     }
 
-    place = EMSG;
-    ++parse_optind;
+    dst[n++] = c;
   }
 
-  return (parse_optopt);           /* dump back option letter */
+  return (n);
+}
+
+/* Set the function that looks up the values of variables, NULL turns
+ * expansion off. */
+void parse_expand(parse_lookup_t fn) {
+  lookup = fn;
 }
 
-uint8_t parse_command(char *cmd, char **argv, uint8_t args) {
-  uint8_t i, argc = 0, quote = 0, first = 1;
-  char *s = cmd, *t = s + strlen(s) - 1;
+/* Set the function that expands wildcards, NULL turns globbing off. */
+void parse_glob(parse_glob_t fn) {
+  glob = fn;
+}
 
-  while ((t >= s) && (*t && (*t == ' '))) *t-- = '\0'; /* trim end */
+/* Set the function that evaluates arithmetic expansions, NULL turns them
+ * off. */
+void parse_arith(parse_arith_t fn) {
+  arith = fn;
+}
 
-  memset(argv, 0, args * sizeof (char *));
+/* Returns the length of the variable reference after a '$' at 's', with
+ * at most 'len' characters, 0 if there is none. The name is stored in
+ * 'name' and its length in 'size'. */
+static uint16_t reference(const char *s, uint16_t len, const char **name, uint8_t *size) {
+  uint16_t n = 0;
 
-  while (*s) {
-    if (first) {
-      first = 0;
+  if (!len) return (0);
 
-      /* skip whitespace */
-      while (*s && (*s == ' ')) s++;
+  if ((*s == '?') || (*s == '$') || (*s == '#') || ((*s >= '0') && (*s <= '9'))) {
+    *name = s;
+    *size = 1;
+    return (1);
+  }
 
-      /* skip quotation mark */
-      if (*s && (*s == '"')) { s++; quote ^= 1; }
+  if ((*s == '{') && (len > 1)) {
+    while ((n + 1 < len) && (s[n + 1] != '}')) n++;
 
-      /* start next arg */
-      *argv++ = s;
+    if ((n + 1 == len) || !n || (n > 255)) return (0);
 
-      if (++argc == args) {
-        return (argc);
-      }
+    *name = s + 1;
+    *size = n;
+    return (n + 2);
+  }
+
+  while ((n < len) && (n < 255) &&
+         ((s[n] == '_') || ((s[n] >= 'A') && (s[n] <= 'Z')) ||
+          ((s[n] >= 'a') && (s[n] <= 'z')) || (n && (s[n] >= '0') && (s[n] <= '9')))) {
+    n++;
+  }
+
+  *name = s;
+  *size = n;
+
+  return (n);
+}
+
+/* Store 'c' at 'dst[n]', unless only measuring. With 'quote' set, a
+ * wildcard or backslash is preceded by a backslash. Returns the number of
+ * characters stored. */
+static uint16_t put(char *dst, uint16_t n, char c, uint8_t quote) {
+  uint16_t k = 0;
+
+  if (quote && ((c == '*') || (c == '?') || (c == '[') || (c == '\\'))) {
+    if (dst) dst[n] = '\\';
+    k++;
+  }
+
+  if (dst) dst[n + k] = c;
+
+  return (k + 1);
+}
+
+/* Unquote the 'len' characters of the word at 'src' like parse_unquote(),
+ * expanding variables and a leading tilde. If 'dst' is NULL, only the
+ * length of the result is computed. With 'pattern' set, the result is a
+ * pattern for the glob function: characters that came from quotes,
+ * escapes or expansions stay literal by a backslash in front of them.
+ * If an arithmetic expansion fails, 'broken' is set. */
+static uint16_t expand(char *dst, const char *src, uint16_t len, uint8_t pattern) {
+  const char *name, *value;
+  uint16_t i = 0, n = 0, ref;
+  uint8_t size;
+  char quote = 0, digits[11];
+  int32_t number;
+  uint32_t mag;
+
+  if (lookup && (len > 0) && (src[0] == '~') && ((len == 1) || (src[1] == '/'))) {
+    src++;
+    len--;
+
+    for (value = lookup("HOME", 4); value && *value; value++) {
+      n += put(dst, n, *value, pattern);
     }
+  }
+
+  for (i=0; i<len; i++) {
+    char c = src[i];
+
+    if (quote == '\'') {
+      if (c == quote) {
+        quote = 0;
+        continue;
+      }
+    } else if (arith && (c == '$') && (ref = arith_span(src + i, len - i))) {
+      if (broken || !arith(src + i + 3, ref - 5, lookup, &number)) {
+        broken = 1;
+        i += ref - 1;
+        continue;
+      }
+
+      // the digits are made from the end, in 32 bit arithmetic
+      size = sizeof (digits);
+      mag = (number < 0) ? 0 - (uint32_t)number : (uint32_t)number;
 
-    if (*s == '"') {
-      *s++ = '\0'; /* remove and skip */
-      if (*s == '"') first = 1;
-      quote ^= 1;
-    } else if ((!quote) && (*s == ' ')) {
-      *s++ = '\0'; /* remove and skip */
-      first = 1;
+      do {
+        digits[--size] = '0' + mag % 10;
+        mag /= 10;
+      } while (mag);
+
+      if (number < 0) digits[--size] = '-';
+
+      for (; size < sizeof (digits); size++) n += put(dst, n, digits[size], pattern);
+
+      i += ref - 1;
+      continue;
+    } else if (lookup && (c == '$') &&
+               (ref = reference(src + i + 1, len - i - 1, &name, &size))) {
+      for (value = lookup(name, size); value && *value; value++) {
+        n += put(dst, n, *value, pattern);
+      }
+
+      i += ref;
+      continue;
+    } else if (quote) {
+      if (c == quote) {
+        quote = 0;
+        continue;
+      }
+
+      if ((c == '\\') && (i + 1 < len) && strchr("\"\\$`", src[i + 1])) {
+        c = src[++i];
+      }
+    } else if ((c == '"') || (c == '\'')) {
+      quote = c;
+      continue;
+    } else if ((c == '\\') && (i + 1 < len)) {
+      n += put(dst, n, src[++i], pattern);
+      continue;
     } else {
-      s++;
+      n += put(dst, n, c, 0);
+      continue;
     }
+
+    n += put(dst, n, c, pattern);
   }
 
-  return (argc);
+  return (n);
+}
+
+/* Replace the word 'argv[*n]' with the 'count' words of 'list'. The vector
+ * is moved to a larger one in arena 'a', room for 'left' more words after
+ * these is kept. Returns NULL, if there is no memory. */
+static char **splice(char **argv, uint16_t *n, uint16_t left, char **list,
+                     uint16_t count, parse_arena_t *a) {
+  char **v = (char **)parse_arena_alloc(a, (*n + count + left + 1) * sizeof (char *));
+
+  if (!v) return (NULL);
+
+  memcpy(v, argv, *n * sizeof (char *));
+  memcpy(v + *n, list, count * sizeof (char *));
+
+  *n += count;
+
+  return (v);
 }
 
-uint8_t parse_optflags(uint8_t argc, char **argv, const char *optstr) {
-  uint8_t opt, n, i, flags = 0;
+/* Split 'line' into words, that are terminated and unquoted in place.
+ * Words with expansions are built in arena 'a', the argument vector, with
+ * a NULL after the last word, is allocated there too. A word with
+ * wildcards is replaced by the sorted names it matches, or kept when
+ * there are none. An operator is an entry pointing into 'parse_ops', see
+ * parse_op(). Returns NULL, if there is no memory or an arithmetic
+ * expansion failed, or with 'argc' set to 255, if the line has or the
+ * wildcards match more than 255 words. */
+char **parse_args(char *line, parse_arena_t *a, uint8_t *argc) {
+  parse_span_t span;
+  uint16_t pos = 0, n = 0;
+  uint8_t op, len;
+  char **argv;
+
+  broken = 0;
+
+  while (parse_word(line, &pos, &span)) n++;
+
+  if (n > 255) {
+    *argc = 255;
+    return (NULL);
+  }
+
+  argv = (char **)parse_arena_alloc(a, (n + 1) * sizeof (char *));
+  if (!argv) return (NULL);
+
+  *argc = n;
+  n = pos = 0;
+
+  while ((n < *argc) && parse_word(line, &pos, &span)) {
+    char *word = line + span.off;
+
+    if (span.flags & PARSE_OPERATOR) {
+      argv[n++] = (char *)parse_ops[span.op];
+      continue;
+    }
+
+    // the character after the word is about to be overwritten, so an
+    // operator right after it is taken now
+    if ((len = operator(line + pos, &op))) {
+      pos += len;
+    } else if (line[pos]) {
+      pos++;
+    }
+
+    if ((span.flags & PARSE_GLOB) && glob) {
+      char *p = (char *)parse_arena_alloc(a, expand(NULL, word, span.len, 1) + 1);
+      uint16_t count, max = 256 - *argc;
+      char **list;
+
+      if (!p || broken) {
+        *argc = 0;
+        return (NULL);
+      }
+
+      p[expand(p, word, span.len, 1)] = '\0';
+
+      if ((count = glob(p, max, a, &list)) > max) {
+        *argc = 255;
+        return (NULL);
+      }
+
+      if (count) {
+        if (!(argv = splice(argv, &n, *argc - n - 1, list, count, a))) return (NULL);
+
+        *argc += count - 1;
+
+        if (len && (n < *argc)) argv[n++] = (char *)parse_ops[op];
+        continue;
+      }
+    }
+
+    if ((span.flags & PARSE_EXPAND) && (lookup || arith)) {
+      // expansions can grow the word, it goes into the arena
+      char *w = (char *)parse_arena_alloc(a, expand(NULL, word, span.len, 0) + 1);
+
+      if (!w || broken) {
+        *argc = 0;
+        return (NULL);
+      }
+
+      w[expand(w, word, span.len, 0)] = '\0';
+      word = w;
+    } else {
+      if (span.flags) span.len = parse_unquote(word, word, span.len);
+
+      word[span.len] = '\0';
+    }
+
+    argv[n++] = word;
+
+    if (len && (n < *argc)) argv[n++] = (char *)parse_ops[op];
+  }
+
+  argv[n] = NULL;
 
-  n = strlen(optstr);
-  if (n > 8) n = 8;
+  return (argv);
+}
 
-  /* reset global option index */
-  parse_optreset = 1;
+/* Returns the index of the option of 'opts' named by the 'len' characters
+ * at 'name', or by the letter 'name[0]' if 'len' is 0. */
+static uint8_t option(const parse_opt_t *opts, const char *name, size_t len) {
+  uint8_t k;
 
-  while ((opt = parse_getopt(argc, argv, optstr)) != 255) {
-    for (i=0; i<n; i++) {
-      if (opt == optstr[i]) flags |= (1<<i);
+  for (k=0; opts[k].letter || opts[k].name; k++) {
+    if (len ? (opts[k].name && !strncmp(opts[k].name, name, len) && !opts[k].name[len]) :
+              (opts[k].letter == *name)) {
+      break;
     }
   }
 
-  return (flags);
+  return (k);
 }
 
-const char *parse_dirname(const char *path) {
-  char *s, *slash = NULL, *ptr = scratch;
+/* Parse the options at the start of 'argv' against the table 'opts' in
+ * one pass. Short options may be grouped as in '-al', long ones are
+ * given as '--name'. The value of an option that takes one follows it
+ * in the same or the next argument, or after a '=' for a long one. The
+ * options given are set in 'flags' by their index in 'opts', their
+ * values are stored in 'values' at that index. Options end at '--' or
+ * the first argument not starting with '-'. Returns the index of the
+ * first argument after the options, 0 after printing an error. */
+uint8_t parse_options(uint8_t argc, char **argv, const parse_opt_t *opts,
+                      uint16_t *flags, char **values) {
+  uint8_t i, k;
+  char *arg, *value;
+  size_t len;
+
+  *flags = 0;
+
+  for (i=1; i<argc; i++) {
+    arg = argv[i];
+
+    if ((arg[0] != '-') || !arg[1]) break;
+
+    if (arg[1] == '-') {
+      if (!arg[2]) return (i + 1);
+
+      arg += 2;
+      value = strchr(arg, '=');
+      len = value ? (size_t)(value++ - arg) : strlen(arg);
+
+      if (!opts[k = option(opts, arg, len)].name) {
+        printf("%s: unknown option -- %.*s\n", *argv, (int)len, arg);
+        return (0);
+      }
+
+      if (!opts[k].value && value) {
+        printf("%s: option takes no argument -- %s\n", *argv, opts[k].name);
+        return (0);
+      }
+    } else {
+      for (arg++; *arg; arg++) {
+        if (!opts[k = option(opts, arg, 0)].letter) {
+          printf("%s: illegal option -- %c\n", *argv, *arg);
+          return (0);
+        }
+
+        // the rest of the argument is the value
+        if (opts[k].value) break;
+
+        *flags |= (uint16_t)1 << k;
+      }
+
+      if (!*arg) continue;
 
-  strcpy(ptr, path);
+      value = arg[1] ? arg + 1 : NULL;
+      arg = NULL;
+    }
+
+    *flags |= (uint16_t)1 << k;
 
-  s = ptr + strlen(ptr) - 1;
-  if (*s == '/') slash = s;;
+    if (!opts[k].value) continue;
 
-  if (slash) {
-    while ((*slash == '/') && (slash != ptr)) {
-      *slash-- = '\0';
+    if (!value) {
+      if (i + 1 == argc) {
+        if (arg) {
+          printf("%s: option requires an argument -- %s\n", *argv, arg);
+        } else {
+          printf("%s: option requires an argument -- %c\n", *argv, opts[k].letter);
+        }
+        return (0);
+      }
+
+      value = argv[++i];
     }
+
+    if (values) values[k] = value;
   }
 
-  slash = strrchr(ptr, '/');
+  return (i);
+}
+
+/* Store the directory part of 'path' in 'dst' of 'size' bytes, which
+ * needs strlen(path) + 2 bytes at most. 'dst' may be 'path' itself.
+ * Returns the length of the result, 0 if it doesn't fit. */
+uint16_t parse_dirname(char *dst, const char *path, uint16_t size) {
+  uint16_t n = strlen(path);
+
+  // trailing slashes and the last name go, then the slashes before it
+  while ((n > 1) && (path[n - 1] == '/')) n--;
+  while (n && (path[n - 1] != '/')) n--;
+  while ((n > 1) && (path[n - 1] == '/')) n--;
 
-  if (slash && (slash != ptr)) {
-    *slash = '\0';
+  if (n + 1 >= size) return (0);
+
+  if (n) {
+    memmove(dst, path, n);
   } else {
-    if (*ptr != '/') *ptr = '.';
-    ptr[1] = '\0';
+    *dst = '.';
+    n = 1;
   }
 
-  return (ptr);
+  dst[n] = '\0';
+
+  return (n);
 }
 
 const char *parse_basename(const char *path) {
@@ -177,49 +676,69 @@ const char *parse_basename(const char *path) {
   return (path);
 }
 
-char *parse_realpath(const char *path) {
-  uint8_t i, len, rel, ind = 0, sz = 0;
-  char buf[64], *tokv[8], *ptr = NULL;
+/* Normalize 'path' in a single pass into 'dst' of 'size' bytes: repeated
+ * slashes and '.' are dropped, a '..' takes away the name before it. The
+ * result is never longer than 'path', or "." if it's empty, so 'dst' may
+ * be 'path' itself and strlen(path) + 2 bytes are always enough. Returns
+ * the length of the result, 0 if it doesn't fit. */
+uint16_t parse_realpath(char *dst, const char *path, uint16_t size) {
+  uint16_t i = 0, j, n = 0, keep, len;
+  uint8_t root = (*path == '/');
+
+  if (size < 2) return (0);
+
+  if (root) dst[n++] = '/';
 
-  strcpy(buf, path);
-  rel = (*path == '/') ? 0 : 1;
+  // the part of the result a '..' can't take away
+  keep = n;
 
-  ptr = strtok(buf, "/");
-  while (ptr != NULL) {
-    if (strcmp(ptr, "..") == 0) {
-      if (ind > 0) ind--;
-    } else if (strcmp(ptr, ".") != 0) {
-      tokv[ind++] = ptr;
+  while (path[i]) {
+    while (path[i] == '/') i++;
+    for (j=i; path[j] && (path[j] != '/'); j++);
 
-      if (ind >= 8) return (NULL);
+    len = j - i;
+
+    if (!len || ((len == 1) && (path[i] == '.'))) {
+      i = j;
+      continue;
     }
-    ptr = strtok(NULL, "/");
-  }
 
-  ptr = scratch;
-  for (i=0; i<ind; i++) {
-    len = strlen(tokv[i]);
+    if ((len == 2) && (path[i] == '.') && (path[i + 1] == '.')) {
+      if (n > keep) {
+        while ((n > keep) && (dst[n - 1] != '/')) n--;
+        if (n > keep) n--;
 
-    if (i > 0 || !rel) {
-      if (++sz >= sizeof (scratch)) return (NULL);
+        i = j;
+        continue;
+      }
 
-      *ptr++ = '/';
+      // above the root is the root, a relative path keeps leading '..'
+      if (root) {
+        i = j;
+        continue;
+      }
     }
 
-    sz += len;
-    if (sz >= sizeof (scratch)) return (NULL);
+    if (n && (dst[n - 1] != '/')) {
+      if (n + 1 >= size) return (0);
 
-    strcpy(ptr, tokv[i]);
-    ptr += len;
-  }
+      dst[n++] = '/';
+    }
+
+    if (n + len >= size) return (0);
 
-  if (ptr == scratch) {
-    if (++sz >= sizeof (scratch)) return (NULL);
+    // 'dst' never gets ahead of 'path'
+    memmove(dst + n, path + i, len);
+    n += len;
 
-    *ptr++ = rel ? '.' : '/';
+    if ((len == 2) && (dst[n - 2] == '.') && (dst[n - 1] == '.')) keep = n;
+
+    i = j;
   }
-  *ptr = '\0';
 
-  return (scratch);
-}
+  if (!n) dst[n++] = '.';
 
+  dst[n] = '\0';
+
+  return (n);
+}
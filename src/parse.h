@@ -3,26 +3,81 @@
 
 #include <stdint.h>
 
-uint8_t parse_command(char *cmd, char **argv, uint8_t args);
+#define PARSE_ARGS     16     // arguments in the inline arena of a command
+#define PARSE_BLOCK    256    // size of an arena block taken from the heap
 
-const char *parse_dirname(const char *path);
+#define PARSE_QUOTED   (1<<0) // word contains quotes
+#define PARSE_ESCAPED  (1<<1) // word contains backslash escapes
+#define PARSE_OPERATOR (1<<2) // word is an operator
+#define PARSE_EXPAND   (1<<3) // word contains expansions
+#define PARSE_GLOB     (1<<4) // word contains wildcards
+
+#define PARSE_OP_PIPE       0    // |
+#define PARSE_OP_OUT        1    // >
+#define PARSE_OP_APPEND     2    // >>
+#define PARSE_OP_IN         3    // <
+#define PARSE_OP_ERR        4    // 2>
+#define PARSE_OP_ERR_APPEND 5    // 2>>
+#define PARSE_OPS           6
+#define PARSE_OP_NONE       0xff // not an operator
+
+typedef struct parse_span_t {
+  uint16_t off;   /* Offset of the word in the line. */
+  uint16_t len;   /* Length of the word, with quotes and escapes. */
+  uint8_t  flags; /* PARSE_QUOTED, PARSE_ESCAPED, PARSE_OPERATOR, ... */
+  uint8_t  op;    /* The operator, if PARSE_OPERATOR is set. */
+} parse_span_t;
+
+/* An option of a command, tables of them end with an entry that has
+ * neither a letter nor a name. An option can have both. */
+typedef struct parse_opt_t {
+  char        letter; /* Letter after '-', or 0. */
+  const char *name;   /* Name after '--', or NULL. */
+  uint8_t     value;  /* Set, if the option takes a value. */
+} parse_opt_t;
+
+/* Returns the value of the variable 'name' of length 'len', or NULL. */
+typedef const char *(*parse_lookup_t)(const char *name, uint8_t len);
+
+typedef struct parse_arena_t {
+  char    *ptr;   /* Free space in the current block. */
+  uint16_t left;  /* Bytes left in the current block. */
+  void    *heap;  /* Blocks taken from the heap, chained. */
+} parse_arena_t;
+
+/* Expands the wildcards of 'pattern', where a backslash quotes the next
+ * character. Up to 'max' matches are stored in arena 'a', the vector of
+ * them in 'list'. Returns the number of matches, more than 'max' if there
+ * are too many. */
+typedef uint16_t (*parse_glob_t)(const char *pattern, uint16_t max,
+                                 parse_arena_t *a, char ***list);
+
+/* Evaluates the 'len' characters of the arithmetic expression at 'expr'
+ * into 'value', with variables from 'lookup'. Returns 0 after printing an
+ * error. */
+typedef uint8_t (*parse_arith_t)(const char *expr, uint16_t len,
+                                 parse_lookup_t lookup, int32_t *value);
+
+void     parse_arena_init(parse_arena_t *a, void *buf, uint16_t size);
+void    *parse_arena_alloc(parse_arena_t *a, uint16_t size);
+void     parse_arena_free(parse_arena_t *a);
+
+extern const char parse_ops[PARSE_OPS][4];
+
+uint8_t  parse_op(const char *word);
+uint8_t  parse_word(const char *line, uint16_t *pos, parse_span_t *span);
+uint16_t parse_unquote(char *dst, const char *src, uint16_t len);
+void     parse_expand(parse_lookup_t fn);
+void     parse_glob(parse_glob_t fn);
+void     parse_arith(parse_arith_t fn);
+char   **parse_args(char *line, parse_arena_t *a, uint8_t *argc);
+uint8_t  parse_shell(const char *line);
+
+uint16_t    parse_dirname(char *dst, const char *path, uint16_t size);
 const char *parse_basename(const char *path);
-      char *parse_realpath(const char *path);
-
-uint8_t parse_optflags(uint8_t argc, char **argv, const char *optstr);
-uint8_t parse_getopt(uint8_t nargc, char **nargv, const char *ostr);
-
-extern char   *parse_optarg;
-extern uint8_t parse_opterr;
-extern uint8_t parse_optind;
-extern uint8_t parse_optopt;
-extern uint8_t parse_optreset;
-
-#define getopt   parse_getopt
-#define optarg   parse_optarg
-#define opterr   parse_opterr
-#define optind   parse_optind
-#define optopt   parse_optopt
-#define optreset parse_optreset
+uint16_t    parse_realpath(char *dst, const char *path, uint16_t size);
+
+uint8_t parse_options(uint8_t argc, char **argv, const parse_opt_t *opts,
+                      uint16_t *flags, char **values);
 
 #endif // _PARSE_H_
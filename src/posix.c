@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // copy_file_range(), splice()
+
 #include <termios.h>
 #include <string.h>
 #include <stdlib.h>
@@ -5,27 +7,78 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <dirent.h>
+#include <poll.h>
 
 #include "posix.h"
 
 #undef printf
 
-static uint8_t cursor_onoff = 0;
-static uint8_t revers_onoff = 0;
+/* The console of the controlling terminal, used unless a session selects
+ * its own console with posix_console(). */
+static posix_con_t console = { .fd = -1 };
+static posix_con_t *con = &console;
 
-static uint8_t color_fg = 0;
-static uint8_t color_bg = 0;
-static uint8_t color_bd = 0;
+static struct termios initial_settings;
+static uint8_t        raw = 0; // terminal is in the mode of posix_init()
 
-static uint8_t cursor_x = 0;
-static uint8_t cursor_y = 0;
-static uint8_t screen_w = 0;
-static uint8_t screen_h = 0;
+/* Write 'len' bytes of 'buf' to the current console. Session output is
+ * collected in its buffer, until the server sends it. */
+static void con_write(const char *buf, int len) {
+  if (con->fd < 0) {
+    fwrite(buf, 1, len, stdout);
+  } else {
+    if (con->olen + len > con->osize) {
+      uint32_t size = con->osize ? con->osize : POSIX_CON_OUT;
+      char *out;
 
-static struct termios initial_settings;
+      while (size < con->olen + len) size *= 2;
+
+      if (!(out = (char *)realloc(con->out, size))) return;
+
+      con->out   = out;
+      con->osize = size;
+    }
+
+    memcpy(con->out + con->olen, buf, len);
+    con->olen += len;
+  }
+}
+
+static void con_flush(void) {
+  if (con->fd < 0) fflush(stdout);
+}
+
+/* Read one byte from the current console, returns 0 if there is none. */
+static uint8_t con_read(uint8_t *c) {
+  if (con->fd < 0) return (read(0, c, 1) == 1);
+
+  if (con->ipos == con->ilen) return (0);
+
+  *c = con->in[con->ipos++];
+
+  return (1);
+}
+
+static int con_printf(const char *format, ...) {
+  char buf[32];
+  va_list ap;
+  int len;
+
+  va_start(ap, format);
+  len = vsnprintf(buf, sizeof (buf), format, ap);
+  va_end(ap);
+
+  if (len >= (int)sizeof (buf)) len = sizeof (buf) - 1;
+  if (len > 0) con_write(buf, len);
+
+  return (len);
+}
 
 static int vcprintf(const char *format, va_list ap) {
   char buf[256];
@@ -38,9 +91,9 @@ static int vcprintf(const char *format, va_list ap) {
 }
 
 static void set_cursor_pos(uint8_t col, uint8_t row) {
-  printf("\e[%i;%iH", row+1, col+1);
-  printf("\e[%i;%if", row+1, col+1);
-  fflush(stdout);
+  con_printf("\e[%i;%iH", row+1, col+1);
+  con_printf("\e[%i;%if", row+1, col+1);
+  con_flush();
 }
 
 static uint8_t get_cursor_pos(uint8_t *col, uint8_t *row) {
@@ -50,14 +103,14 @@ static uint8_t get_cursor_pos(uint8_t *col, uint8_t *row) {
   int c, r;
 
   // request cursor location
-  printf("\e[6n");
-  fflush(stdout);
+  con_printf("\e[6n");
+  con_flush();
 
   // wait for response to arrive
   for (uint8_t i=0; i<50; i++) {
     char c;
 
-    if (read(0, &c, 1)) {
+    if (con_read((uint8_t *)&c)) {
       // read until 'R'
       if (c == 'R') {
         timeout = 0;
@@ -113,33 +166,36 @@ static uint8_t get_screen_size(uint8_t *cols, uint8_t *rows) {
 }
 
 void clrscr(void) {
-  printf("\e[H\e[J");
+  con_printf("\e[H\e[J");
   gotoxy(0, 0);
 }
 
 void gotoxy(uint8_t x, uint8_t y) {
-  cursor_x = x;
-  cursor_y = y;
+  con->x = x;
+  con->y = y;
 
   set_cursor_pos(x, y);
 }
 
 uint8_t wherex(void) {
-  return (cursor_x);
+  return (con->x);
 }
 
 uint8_t wherey(void) {
-  return (cursor_y);
+  return (con->y);
 }
 
-void cputs(const char *s) {
+/* Write the 'len' bytes at 's' to the console, keeping track of the
+ * cursor. */
+static void con_puts(const char *s, int len) {
   uint8_t in_esc_seq = 0;
-  int len = printf(s);
+
+  con_write(s, len);
 
   for (int i=0; i<len; i++) {
 
-         if (s[i] == '\r') cursor_x = 0;
-    else if (s[i] == '\n') cursor_y++;
+         if (s[i] == '\r') con->x = 0;
+    else if (s[i] == '\n') con->y++;
     else {
       if (in_esc_seq) {
         if ((s[i] >= 'A' && s[i] <= 'Z') || (s[i] >= 'a' && s[i] <= 'z')) {
@@ -150,23 +206,27 @@ void cputs(const char *s) {
           in_esc_seq = 1;
         } else {
           if (s[i] >= 32 && s[i] < 127) {
-            cursor_x++;
+            con->x++;
           }
         }
       }
     }
 
-    if (cursor_x >= screen_w) {
-      cursor_x = 0;
-      cursor_y++;
+    if (con->x >= con->w) {
+      con->x = 0;
+      con->y++;
     }
   }
 
-  if (cursor_y >= screen_h) {
-    cursor_y = screen_h - 1;
+  if (con->y >= con->h) {
+    con->y = con->h - 1;
   }
 
-  fflush(stdout);
+  con_flush();
+}
+
+void cputs(const char *s) {
+  con_puts(s, (int)strlen(s));
 }
 
 void cputc(char c) {
@@ -178,7 +238,7 @@ void cputc(char c) {
 char cgetc(void) {
   uint8_t seq[4], c = 0;
 
-	if (!read(0, &c, 1)) {
+	if (!con_read(&c)) {
     return (0);
   }
 
@@ -190,21 +250,21 @@ char cgetc(void) {
     // use two calls to handle slow terminals returning the two
     // chars at different times.
 
-	  if (!read(0, seq+0, 1)) return (27);
-	  if (!read(0, seq+1, 1)) return (0);
+	  if (!con_read(seq+0)) return (27);
+	  if (!con_read(seq+1)) return (0);
 
     // ESC [ sequences
     if (seq[0] == '[') {
       if (seq[1] >= '0' && seq[1] <= '9') {
         // extended escape, read additional byte
-	      if (!read(0, seq+2, 1)) return (0);
+	      if (!con_read(seq+2)) return (0);
         if (seq[2] == '~') {
           if (seq[1] == '2') return (43);  // INSERT
           if (seq[1] == '3') return (127); // DELETE
           if (seq[1] == '5') return (1);   // PG-UP
           if (seq[1] == '6') return (5);   // PG_DOWN
         } else {
-	        if (!read(0, seq+3, 1)) return (0);
+	        if (!con_read(seq+3)) return (0);
         }
       } else {
         if (seq[1] == 'A') return (16); // UP
@@ -223,63 +283,71 @@ char cgetc(void) {
   return (c);
 }
 
+uint8_t kbhit(void) {
+  struct pollfd pfd = { 0, POLLIN, 0 };
+
+  if (con->fd >= 0) return (con->ipos < con->ilen);
+
+  return (poll(&pfd, 1, 0) > 0);
+}
+
 uint8_t cursor(uint8_t onoff) {
-  uint8_t old = cursor_onoff;
+  uint8_t old = con->cursor;
 
-  cursor_onoff = onoff;
+  con->cursor = onoff;
 
-  printf("\e[?25%c", (onoff) ? 'h' : 'l');
-  fflush(stdout);
+  con_printf("\e[?25%c", (onoff) ? 'h' : 'l');
+  con_flush();
 
   return (old);
 }
 
 uint8_t revers(uint8_t onoff) {
-  uint8_t old = revers_onoff;
+  uint8_t old = con->revers;
 
-  revers_onoff = onoff;
+  con->revers = onoff;
 
-  printf("\e[%um", (onoff) ? 7 : 27);
+  con_printf("\e[%um", (onoff) ? 7 : 27);
 
   return (old);
 }
 
 uint8_t textcolor(uint8_t color) {
-  uint8_t old = color_fg;
+  uint8_t old = con->fg;
 
-  color_fg = color;
+  con->fg = color;
 
   // make COLOR_WHITE bright
-  printf("\e[%i;%im", (color == 7) ? 1 : 0, color + 30);
+  con_printf("\e[%i;%im", (color == 7) ? 1 : 0, color + 30);
 
   return (old);
 }
 
 uint8_t bgcolor(uint8_t color) {
-  uint8_t old = color_bg;
+  uint8_t old = con->bg;
 
-  color_bg = color;
+  con->bg = color;
 
-  printf("\e[%im", color + 40);
+  con_printf("\e[%im", color + 40);
 
   return (old);
 }
 
 uint8_t bordercolor(uint8_t color) {
-  uint8_t old = color_bd;
+  uint8_t old = con->bd;
 
-  color_bd = color;
+  con->bd = color;
 
   return (old);
 }
 
 void screensize(uint8_t *x, uint8_t *y) {
-  if (!screen_w || !screen_h) {
-    get_screen_size(&screen_w, &screen_h);
+  if (!con->w || !con->h) {
+    get_screen_size(&con->w, &con->h);
   }
 
-  *x = screen_w;
-  *y = screen_h;
+  *x = con->w;
+  *y = con->h;
 }
 
 int cprintf(const char *format, ...) {
@@ -304,11 +372,37 @@ uint8_t posix_init(void) {
 
 	tcsetattr(0, TCSANOW, &new_settings);
 
+  raw = 1;
+
   return (1);
 }
 
-void posix_fini(void) {
+/* Restore the initial terminal mode. Returns 0, if the terminal wasn't
+ * taken by posix_init(), as when running a script. */
+uint8_t posix_fini(void) {
+  if (!raw) return (0);
+
 	tcsetattr(0, TCSANOW, &initial_settings);
+
+  raw = 0;
+
+  return (1);
+}
+
+/* Make 'c' the console all conio calls work on, NULL selects the one of
+ * the controlling terminal again. */
+void posix_console(posix_con_t *c) {
+  con = c ? c : &console;
+}
+
+/* Set the socket of the current console, -1 lets the conio calls write
+ * to stdout. Returns the previous one. */
+int posix_console_fd(int fd) {
+  int old = con->fd;
+
+  con->fd = fd;
+
+  return (old);
 }
 
 char *fileio_getcwd(char *buf, uint8_t size) {
@@ -350,7 +444,7 @@ uint8_t fileio_ls(uint8_t flags, const char *path) {
   const char *time = "2000/12/31 00:00";
   DIR *dir = opendir(path);
   struct dirent *entry;
-  uint8_t files = 1;
+  uint8_t files = 1, ret = 0;
   struct stat st;
 
   if (flags & 0x02) { listall = 1;               }
@@ -360,6 +454,7 @@ uint8_t fileio_ls(uint8_t flags, const char *path) {
   if (!dir) {
     if (stat(path, &st) < 0) {
       perror("ls");
+      ret = 1;
     } else {
       if (listlong) {
         cprintf("FILE %6li %s %s\n", st.st_size, time, path);
@@ -403,7 +498,113 @@ uint8_t fileio_ls(uint8_t flags, const char *path) {
     cprintf("\n");
   }
 
-  return (0);
+  return (ret);
+}
+
+#define COPY_RANGE    0       // file to file, within the file system
+#define COPY_SPLICE   1       // from or to a pipe
+#define COPY_SENDFILE 2       // from a file to anything
+#define COPY_READ     3       // through a buffer
+#define COPY_CONSOLE  4       // through a buffer, to the console of a session
+#define COPY_CHUNK    (1<<16) // bytes moved per call
+
+/* Copy what's left of 'in' to 'out' with read() and write(). */
+static ssize_t copy_read(int in, int out) {
+  char buf[4096];
+  ssize_t n, done, w;
+
+  if ((n = read(in, buf, sizeof (buf))) <= 0) return (n);
+
+  for (done = 0; done < n; done += w) {
+    if ((w = write(out, buf + done, n - done)) < 0) {
+      if (errno == EINTR) { w = 0; continue; }
+      return (-1);
+    }
+  }
+
+  return (n);
+}
+
+/* Copy what's left of 'in' to the console, with read(). */
+static ssize_t copy_console(int in) {
+  char buf[4096];
+  ssize_t n;
+
+  if ((n = read(in, buf, sizeof (buf))) > 0) con_puts(buf, (int)n);
+
+  return (n);
+}
+
+/* Copy the file 'path', or standard input if it's NULL, to standard
+ * output. The data is moved by the kernel, with the first call of
+ * copy_file_range(), splice() and sendfile() that works for the kinds
+ * of files involved. Only if none does, it goes through a buffer. The
+ * console of a session is always written through its buffer, to keep
+ * the order with the other output. Returns -1 with errno set, or 1 after
+ * reporting that the file is the output, which it would never finish. */
+int8_t fileio_cat(const char *path) {
+  int in = path ? open(path, O_RDONLY | O_CLOEXEC) : 0;
+  struct stat si, so;
+  uint8_t how;
+  ssize_t n;
+
+  if (in < 0) return (-1);
+
+  fflush(stdout);
+
+  if (fstat(in, &si) || fstat(1, &so)) {
+    n = -1;
+  } else if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode) &&
+             (si.st_dev == so.st_dev) && (si.st_ino == so.st_ino)) {
+    fprintf(stderr, "cat: %s: input file is output file\n", path ? path : "-");
+    n = -2;
+  } else {
+    if (con->fd >= 0) {
+      how = COPY_CONSOLE;
+    } else if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode)) {
+      how = COPY_RANGE;
+    } else if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode)) {
+      how = COPY_SPLICE;
+    } else if (S_ISREG(si.st_mode)) {
+      how = COPY_SENDFILE;
+    } else {
+      how = COPY_READ;
+    }
+
+    do {
+      switch (how) {
+        case COPY_RANGE:
+          n = copy_file_range(in, NULL, 1, NULL, COPY_CHUNK, 0);
+          break;
+        case COPY_SPLICE:
+          n = splice(in, NULL, 1, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+          break;
+        case COPY_SENDFILE:
+          n = sendfile(1, in, NULL, COPY_CHUNK);
+          break;
+        case COPY_CONSOLE:
+          n = copy_console(in);
+          break;
+        default:
+          n = copy_read(in, 1);
+          break;
+      }
+
+      if ((n < 0) && (errno == EINTR)) {
+        n = 1;
+      } else if ((n < 0) && (how < COPY_READ) &&
+                 ((errno == EINVAL) || (errno == EXDEV) || (errno == EBADF) ||
+                  (errno == ENOSYS) || (errno == EOPNOTSUPP))) {
+        // the kernel can't do it this way, try the next one
+        how = ((how != COPY_SENDFILE) && S_ISREG(si.st_mode)) ? COPY_SENDFILE : COPY_READ;
+        n = 1;
+      }
+    } while (n > 0);
+  }
+
+  if (path) close(in);
+
+  return ((n == -2) ? 1 : (n < 0) ? -1 : 0);
 }
 
 void fileio_mount(const char *dev, const char *dir) {
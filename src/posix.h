@@ -9,6 +9,7 @@
 #define COLOR_MAGENTA         5
 #define COLOR_CYAN            6
 #define COLOR_WHITE           7
+#define COLOR_GRAY           60 // bright black
 
 #define COLOR_DEFAULT         9
 
@@ -19,9 +20,35 @@
 
 #define printf cprintf
 
+#define POSIX_CON_IN  64  // size of the input buffer of a console
+#define POSIX_CON_OUT 256 // initial size of the output buffer
+
+/* The state of a console. The conio functions work on the current one,
+ * that is the controlling terminal, unless a session of the server has
+ * selected its own. Session input is fed into 'in' by the server, output
+ * is collected in 'out' until the server sends it. */
+typedef struct posix_con_t {
+  int      fd;      /* Socket of the session, -1 for stdin and stdout. */
+  uint8_t  x, y;    /* Cursor position. */
+  uint8_t  w, h;    /* Screen size, queried on first use if zero. */
+  uint8_t  fg, bg;  /* Text and background color. */
+  uint8_t  bd;      /* Border color. */
+  uint8_t  cursor;  /* Cursor is shown. */
+  uint8_t  revers;  /* Reverse mode is on. */
+  uint8_t  ipos;    /* Next byte to read from 'in'. */
+  uint8_t  ilen;    /* Bytes in 'in'. */
+  uint8_t  in[POSIX_CON_IN];
+  uint32_t olen;    /* Bytes in 'out'. */
+  uint32_t osize;   /* Size of 'out'. */
+  char    *out;
+} posix_con_t;
+
 uint8_t posix_init(void);
-void    posix_fini(void);
+uint8_t posix_fini(void);
+void    posix_console(posix_con_t *c);
+int     posix_console_fd(int fd);
 
 int cprintf(const char *format, ...);
+uint8_t kbhit(void);
 
 #endif // _POSIX_H_
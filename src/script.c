@@ -0,0 +1,1248 @@
+/* script.c -- script files.
+ *
+ * Scripts are run with 'source <file>' or 'push <file>'. They are compiled
+ * once into bytecode, that a small interpreter runs, so the commands of a
+ * loop aren't split up again on every pass. Commands without expansions
+ * are stored already split into words, with the builtin they name looked
+ * up when the script is loaded. Only commands with '$', '~' or wildcards
+ * are split when they run, as their words depend on variables and files.
+ *
+ * The bytecode is written next to the script, to '<file>.pushc', and is
+ * used as long as the script keeps its modification and change time and
+ * its size. It is only trusted, if it has the owner of the script and no
+ * one else can write it, and it is checked once when it is loaded. Loaded
+ * scripts stay in memory for the same, so functions defined by a sourced
+ * script can be called later.
+ *
+ * The language is a small part of the one of sh: commands end at a
+ * newline or ';', and there are
+ *
+ *   if <commands>; then <commands>; [elif ...;] [else <commands>;] fi
+ *   while <commands>; do <commands>; done
+ *   for <name> in <words>; do <commands>; done
+ *   <name>() { <commands>; }
+ *   break, continue, return [<status>]
+ *
+ * Commands in other syntax of sh, like lists with '&&' or command
+ * substitution, are run by sh as a whole.
+ *
+ * Conditions are true when the last command has the status 0. Functions
+ * and scripts see their arguments as $1 to $9 and their count as $#.
+ */
+
+#ifdef HAVE_SCRIPT
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+#include "var.h"
+#include "cli.h"
+#include "script.h"
+
+#define SCRIPT_MAGIC   "PSHC"   // start of a compiled script
+#define SCRIPT_VERSION 3        // version of the bytecode
+#define SCRIPT_SUFFIX  ".pushc" // name of the compiled script
+#define SCRIPT_DEPTH   32       // nesting of functions and scripts
+#define SCRIPT_LOOPS   8        // nesting of loops
+#define SCRIPT_FUNCS   64       // functions defined
+#define SCRIPT_OP      0xff00   // word offset flag of an operator
+#define SCRIPT_NONE    0xffff   // end of a jump chain, no return status
+
+#define SCRIPT_END     0        // end of the script
+#define SCRIPT_CMD     1        // rec: run a split command
+#define SCRIPT_LINE    2        // rec: split and run a command line
+#define SCRIPT_JMP     3        // to: jump
+#define SCRIPT_JF      4        // to: jump, if the status isn't 0
+#define SCRIPT_FOR     5        // rec: split the words of a loop
+#define SCRIPT_NEXT    6        // name, to: set the next word or jump
+#define SCRIPT_DONE    7        // drop the words of the loop
+#define SCRIPT_DEF     8        // name, to: define a function and jump
+#define SCRIPT_RET     9        // status: return from the function
+
+/* Size of the instructions, with their operands. */
+static const uint8_t sizes[] = { 1, 3, 3, 3, 3, 3, 5, 1, 5, 3 };
+
+/* Lines that end a list of commands. */
+static const char *const reserved[] = {
+  "then", "elif", "else", "fi", "do", "done", "}", NULL
+};
+
+typedef struct script_hdr_t {
+  char     magic[4];  /* SCRIPT_MAGIC. */
+  uint16_t version;   /* SCRIPT_VERSION. */
+  uint16_t code;      /* Size of the code, the pool follows. */
+  uint32_t size;      /* Size of code and pool. */
+  int64_t  sec;       /* Modification time of the script. */
+  int64_t  nsec;
+  int64_t  csec;      /* Change time of the script. */
+  int64_t  cnsec;
+  int64_t  length;    /* Size of the script. */
+} script_hdr_t;
+
+typedef struct script_t {
+  dev_t            dev;  /* Device of the script. */
+  ino_t            ino;  /* Inode of the script. */
+  uint8_t          busy; /* Running, can't be replaced. */
+  script_hdr_t    *hdr;  /* Header, code and pool. */
+  uint8_t         *code; /* Instructions. */
+  uint8_t         *pool; /* Names, lines and commands. */
+  struct script_t *next;
+} script_t;
+
+typedef struct func_t {
+  const char *name;      /* In the pool of the script. */
+  script_t   *script;
+  uint16_t    pc;        /* Start of the function. */
+} func_t;
+
+typedef struct loop_t {
+  uint16_t top;          /* Target of continue. */
+  uint16_t brk;          /* Chain of break jumps. */
+} loop_t;
+
+typedef struct compiler_t {
+  const char *path;      /* Script, for error messages. */
+  const char *src;       /* Text of the script. */
+  size_t      len;
+  size_t      pos;       /* Start of the next command. */
+  uint16_t    lines;     /* Lines read. */
+  uint16_t    line;      /* Line of the current command. */
+  char       *buf;       /* Current command. */
+  size_t      size;
+  char       *cmd;       /* Unread rest of the command in 'buf'. */
+  uint8_t     have;      /* There is an unread rest. */
+  uint8_t     error;
+  uint8_t    *code;
+  uint32_t    clen, csize;
+  uint8_t    *pool;
+  uint32_t    plen, psize;
+  uint8_t     loops;     /* Loops entered. */
+  loop_t      loop[SCRIPT_LOOPS];
+} compiler_t;
+
+static script_t *scripts = NULL;       // scripts loaded
+static func_t    funcs[SCRIPT_FUNCS];  // functions defined
+static uint8_t   nfuncs = 0;
+static uint8_t   depth = 0;            // functions and scripts running
+static uint8_t   args_argc = 0;        // arguments of the running one
+static char    **args_argv = NULL;
+
+static uint16_t get16(const uint8_t *p) {
+  uint16_t v;
+
+  memcpy(&v, p, sizeof (v));
+
+  return (v);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  memcpy(p, &v, sizeof (v));
+}
+
+/* Report a syntax error at the word 'near', NULL for the end of the
+ * script. */
+static void syntax(compiler_t *c, const char *near) {
+  if (c->error) return;
+
+  if (near) {
+    printf("%s:%u: syntax error near '%.*s'\n", c->path, c->line,
+           (int)strcspn(near, " \t"), near);
+  } else {
+    printf("%s:%u: unexpected end of file\n", c->path, c->lines);
+  }
+
+  c->error = 1;
+}
+
+/* Append 'len' bytes of 'data' to the buffer 'buf' of 'size' bytes with
+ * 'used' in use, which can't grow beyond 'max'. Returns the offset of the
+ * data, SCRIPT_NONE if it doesn't fit. */
+static uint16_t append(uint8_t **buf, uint32_t *used, uint32_t *size,
+                       const void *data, uint32_t len, uint32_t max) {
+  uint32_t at = *used;
+
+  if (at + len > max) return (SCRIPT_NONE);
+
+  if (at + len > *size) {
+    uint32_t n = *size ? *size : 256;
+    uint8_t *b;
+
+    while (at + len > n) n *= 2;
+
+    if (!(b = (uint8_t *)realloc(*buf, n))) return (SCRIPT_NONE);
+
+    *buf  = b;
+    *size = n;
+  }
+
+  memcpy(*buf + at, data, len);
+  *used += len;
+
+  return ((uint16_t)at);
+}
+
+static uint16_t emit(compiler_t *c, uint8_t op, uint16_t x, uint16_t y) {
+  uint8_t ins[5];
+  uint16_t at;
+
+  ins[0] = op;
+  put16(ins + 1, x);
+  put16(ins + 3, y);
+
+  // the last offset is kept free for SCRIPT_NONE
+  at = append(&c->code, &c->clen, &c->csize, ins, sizes[op], SCRIPT_NONE);
+
+  if (at == SCRIPT_NONE) {
+    if (!c->error) printf("%s: script too large\n", c->path);
+    c->error = 1;
+  }
+
+  return (at);
+}
+
+static uint16_t pool_add(compiler_t *c, const void *data, uint32_t len) {
+  uint16_t at = append(&c->pool, &c->plen, &c->psize, data, len, SCRIPT_NONE);
+
+  if (at == SCRIPT_NONE) {
+    if (!c->error) printf("%s: script too large\n", c->path);
+    c->error = 1;
+  }
+
+  return (at);
+}
+
+/* Point the jump at 'at' to 'to'. */
+static void patch(compiler_t *c, uint16_t at, uint16_t to) {
+  if (c->error) return;
+
+  if ((c->code[at] == SCRIPT_NEXT) || (c->code[at] == SCRIPT_DEF)) {
+    put16(c->code + at + 3, to);
+  } else {
+    put16(c->code + at + 1, to);
+  }
+}
+
+/* Point the chain of jumps starting at 'at' to 'to'. */
+static void patch_chain(compiler_t *c, uint16_t at, uint16_t to) {
+  while (!c->error && (at != SCRIPT_NONE)) {
+    uint16_t next = get16(c->code + at + 1);
+
+    put16(c->code + at + 1, to);
+    at = next;
+  }
+}
+
+/* Read the next command of the script into 'buf'. A command ends at a
+ * newline or ';' outside of quotes, a '#' starting a word comments out the
+ * rest of the line and a backslash before a newline joins the lines. Empty
+ * commands are skipped. Returns 0 at the end of the script. */
+static uint8_t next(compiler_t *c) {
+  while (c->pos < c->len) {
+    uint8_t word = 1;
+    size_t n = 0;
+    char quote = 0;
+
+    c->line = c->lines + 1;
+
+    while (c->pos < c->len) {
+      char ch = c->src[c->pos++];
+
+      if (n + 3 > c->size) {
+        size_t size = c->size ? c->size * 2 : 256;
+        char *b = (char *)realloc(c->buf, size);
+
+        if (!b) {
+          c->error = 1;
+          return (0);
+        }
+
+        c->buf  = b;
+        c->size = size;
+      }
+
+      if (quote) {
+        if (ch == quote) {
+          quote = 0;
+        } else if ((ch == '\\') && (quote == '"') && (c->pos < c->len)) {
+          c->buf[n++] = ch;
+          ch = c->src[c->pos++];
+        }
+      } else if ((ch == '\n') || (ch == ';')) {
+        if (ch == '\n') c->lines++;
+        break;
+      } else if ((ch == '#') && word) {
+        while ((c->pos < c->len) && (c->src[c->pos] != '\n')) c->pos++;
+        continue;
+      } else if ((ch == '"') || (ch == '\'')) {
+        quote = ch;
+      } else if ((ch == '\\') && (c->pos < c->len)) {
+        if (c->src[c->pos] == '\n') {
+          c->pos++;
+          c->lines++;
+          continue;
+        }
+
+        c->buf[n++] = ch;
+        ch = c->src[c->pos++];
+      }
+
+      if (ch == '\n') c->lines++;
+      if (ch == '\r') ch = ' ';
+
+      word = ((ch == ' ') || (ch == '\t'));
+      c->buf[n++] = ch;
+    }
+
+    while (n && ((c->buf[n - 1] == ' ') || (c->buf[n - 1] == '\t'))) n--;
+
+    if (!n) continue;
+
+    c->buf[n] = '\0';
+
+    for (c->cmd = c->buf; (*c->cmd == ' ') || (*c->cmd == '\t'); c->cmd++);
+
+    if (*c->cmd) {
+      c->have = 1;
+      return (1);
+    }
+  }
+
+  return (0);
+}
+
+/* Returns the rest of the current command, NULL at the end. */
+static const char *peek(compiler_t *c) {
+  if (c->error || (!c->have && !next(c))) return (NULL);
+
+  return (c->cmd);
+}
+
+/* Consume the first 'n' characters of the current command. */
+static void take(compiler_t *c, size_t n) {
+  c->cmd += n;
+
+  while ((*c->cmd == ' ') || (*c->cmd == '\t')) c->cmd++;
+
+  if (!*c->cmd) c->have = 0;
+}
+
+/* Returns the length of keyword 'kw', if 'cmd' starts with it. */
+static size_t keyword(const char *cmd, const char *kw) {
+  size_t n = strlen(kw);
+
+  if (strncmp(cmd, kw, n)) return (0);
+  if (cmd[n] && (cmd[n] != ' ') && (cmd[n] != '\t')) return (0);
+
+  return (n);
+}
+
+/* Returns the length of the first keyword of 'kws', 'cmd' starts with. */
+static size_t keywords(const char *cmd, const char *const *kws) {
+  size_t n;
+
+  for (; *kws; kws++) {
+    if ((n = keyword(cmd, *kws))) return (n);
+  }
+
+  return (0);
+}
+
+/* Consume keyword 'kw', that must come next. */
+static uint8_t expect(compiler_t *c, const char *kw) {
+  const char *cmd = peek(c);
+  size_t n;
+
+  if (!cmd || !(n = keyword(cmd, kw))) {
+    syntax(c, cmd);
+    return (0);
+  }
+
+  take(c, n);
+
+  return (1);
+}
+
+/* Returns the length of "<name>()" at the start of 'cmd', 0 if it's not
+ * a function definition. */
+static size_t function(const char *cmd) {
+  size_t n = var_name(cmd);
+
+  if (!n) return (0);
+
+  while ((cmd[n] == ' ') || (cmd[n] == '\t')) n++;
+
+  return (((cmd[n] == '(') && (cmd[n + 1] == ')')) ? n + 2 : 0);
+}
+
+static uint16_t name_add(compiler_t *c, const char *name, size_t len) {
+  uint16_t at = pool_add(c, name, len);
+  char nul = '\0';
+
+  pool_add(c, &nul, 1);
+
+  return (at);
+}
+
+/* Add the command line 'cmd' to the pool as it is. */
+static uint16_t line_add(compiler_t *c, const char *cmd) {
+  size_t len = strlen(cmd);
+  uint8_t head[2];
+  uint16_t at;
+
+  if (len > UINT16_MAX - 1) len = UINT16_MAX - 1;
+
+  put16(head, len);
+
+  at = pool_add(c, head, 2);
+  name_add(c, cmd, len);
+
+  return (at);
+}
+
+/* Add the command 'cmd' split into words to the pool: the argument count,
+ * a byte for the builtin, the size of the text, the word offsets and the
+ * words. Returns SCRIPT_NONE, if it has to be split when it runs. */
+static uint16_t command_add(compiler_t *c, const char *cmd) {
+  size_t len = strlen(cmd) + 1;
+  uint8_t argc, i, *rec;
+  parse_arena_t a;
+  char **argv;
+  uint16_t at;
+
+  if (strpbrk(cmd, "$~*?[") || (len >= SCRIPT_OP)) return (SCRIPT_NONE);
+#ifdef HAVE_EXEC
+  if (parse_shell(cmd)) return (SCRIPT_NONE);
+#endif
+
+  if (!(rec = (uint8_t *)malloc(4 + 2 * 255 + len))) return (SCRIPT_NONE);
+
+  parse_arena_init(&a, NULL, 0);
+
+  // split a copy at its place in the record
+  memcpy(rec + 4 + 2 * 255, cmd, len);
+
+  if (!(argv = parse_args((char *)rec + 4 + 2 * 255, &a, &argc))) {
+    parse_arena_free(&a);
+    free(rec);
+    return (SCRIPT_NONE);
+  }
+
+  rec[0] = argc;
+  rec[1] = 0xff; // looked up when loaded
+  put16(rec + 2, len);
+
+  for (i=0; i<argc; i++) {
+    uint8_t op = parse_op(argv[i]);
+
+    put16(rec + 4 + 2 * i, (op != PARSE_OP_NONE) ? SCRIPT_OP | op :
+          (uint16_t)(argv[i] - ((char *)rec + 4 + 2 * 255)));
+  }
+
+  memmove(rec + 4 + 2 * argc, rec + 4 + 2 * 255, len);
+
+  at = pool_add(c, rec, 4 + 2 * argc + len);
+
+  parse_arena_free(&a);
+  free(rec);
+
+  return (at);
+}
+
+static void list(compiler_t *c, const char *const *ends);
+
+static void compile_if(compiler_t *c) {
+  static const char *const then[] = { "then", NULL };
+  static const char *const rest[] = { "elif", "else", "fi", NULL };
+  static const char *const fi[]   = { "fi", NULL };
+  uint16_t jf, end = SCRIPT_NONE;
+  const char *cmd;
+  size_t n;
+
+  list(c, then);
+  if (!expect(c, "then")) return;
+
+  jf = emit(c, SCRIPT_JF, 0, 0);
+  list(c, rest);
+
+  while (!c->error && (cmd = peek(c)) && (n = keyword(cmd, "elif"))) {
+    end = emit(c, SCRIPT_JMP, end, 0);
+    patch(c, jf, c->clen);
+    take(c, n);
+
+    list(c, then);
+    if (!expect(c, "then")) return;
+
+    jf = emit(c, SCRIPT_JF, 0, 0);
+    list(c, rest);
+  }
+
+  if (!c->error && (cmd = peek(c)) && (n = keyword(cmd, "else"))) {
+    end = emit(c, SCRIPT_JMP, end, 0);
+    patch(c, jf, c->clen);
+    jf = SCRIPT_NONE;
+    take(c, n);
+
+    list(c, fi);
+  }
+
+  if (!expect(c, "fi")) return;
+
+  if (jf != SCRIPT_NONE) patch(c, jf, c->clen);
+  patch_chain(c, end, c->clen);
+}
+
+static void compile_while(compiler_t *c) {
+  static const char *const doo[]  = { "do", NULL };
+  static const char *const done[] = { "done", NULL };
+  loop_t *l = &c->loop[c->loops];
+  uint16_t jf;
+
+  l->top = c->clen;
+  l->brk = SCRIPT_NONE;
+
+  list(c, doo);
+  if (!expect(c, "do")) return;
+
+  jf = emit(c, SCRIPT_JF, 0, 0);
+
+  c->loops++;
+  list(c, done);
+  c->loops--;
+
+  if (!expect(c, "done")) return;
+
+  emit(c, SCRIPT_JMP, l->top, 0);
+  patch(c, jf, c->clen);
+  patch_chain(c, l->brk, c->clen);
+}
+
+static void compile_for(compiler_t *c) {
+  static const char *const done[] = { "done", NULL };
+  loop_t *l = &c->loop[c->loops];
+  const char *cmd = peek(c);
+  uint16_t name;
+  size_t n;
+
+  if (!cmd || !(n = var_name(cmd)) || (cmd[n] && (cmd[n] != ' ') && (cmd[n] != '\t'))) {
+    syntax(c, cmd);
+    return;
+  }
+
+  name = name_add(c, cmd, n);
+  take(c, n);
+
+  if (!expect(c, "in")) return;
+
+  // the words are split each time the loop starts
+  emit(c, SCRIPT_FOR, line_add(c, c->have ? c->cmd : ""), 0);
+  c->have = 0;
+
+  if (!expect(c, "do")) return;
+
+  l->top = emit(c, SCRIPT_NEXT, name, 0);
+  l->brk = SCRIPT_NONE;
+
+  c->loops++;
+  list(c, done);
+  c->loops--;
+
+  if (!expect(c, "done")) return;
+
+  emit(c, SCRIPT_JMP, l->top, 0);
+  patch(c, l->top, c->clen);
+  patch_chain(c, l->brk, c->clen);
+  emit(c, SCRIPT_DONE, 0, 0);
+}
+
+static void compile_function(compiler_t *c, size_t n) {
+  static const char *const end[] = { "}", NULL };
+  const char *cmd = peek(c);
+  uint8_t loops = c->loops;
+  uint16_t def;
+  size_t k;
+
+  def = emit(c, SCRIPT_DEF, name_add(c, cmd, var_name(cmd)), 0);
+  take(c, n);
+
+  if (!expect(c, "{")) return;
+
+  // loops around the definition can't be left from inside it
+  c->loops = 0;
+  list(c, end);
+  c->loops = loops;
+
+  if ((cmd = peek(c)) && (k = keyword(cmd, "}"))) {
+    take(c, k);
+  } else {
+    syntax(c, cmd);
+    return;
+  }
+
+  emit(c, SCRIPT_RET, SCRIPT_NONE, 0);
+  patch(c, def, c->clen);
+}
+
+static void statement(compiler_t *c) {
+  const char *cmd = peek(c);
+  uint16_t rec;
+  size_t n;
+
+  if ((n = keyword(cmd, "if"))) {
+    take(c, n);
+    compile_if(c);
+  } else if ((n = keyword(cmd, "while"))) {
+    if (c->loops == SCRIPT_LOOPS) {
+      syntax(c, cmd);
+      return;
+    }
+
+    take(c, n);
+    compile_while(c);
+  } else if ((n = keyword(cmd, "for"))) {
+    if (c->loops == SCRIPT_LOOPS) {
+      syntax(c, cmd);
+      return;
+    }
+
+    take(c, n);
+    compile_for(c);
+  } else if ((n = keyword(cmd, "break")) || (n = keyword(cmd, "continue"))) {
+    loop_t *l;
+
+    if (!c->loops) {
+      syntax(c, cmd);
+      return;
+    }
+
+    l = &c->loop[c->loops - 1];
+
+    if (*cmd == 'b') {
+      l->brk = emit(c, SCRIPT_JMP, l->brk, 0);
+    } else {
+      emit(c, SCRIPT_JMP, l->top, 0);
+    }
+
+    take(c, n);
+  } else if ((n = keyword(cmd, "return"))) {
+    take(c, n);
+
+    emit(c, SCRIPT_RET, c->have ? (uint8_t)atoi(c->cmd) : SCRIPT_NONE, 0);
+    c->have = 0;
+  } else if ((n = function(cmd))) {
+    compile_function(c, n);
+  } else {
+    if ((rec = command_add(c, cmd)) != SCRIPT_NONE) {
+      emit(c, SCRIPT_CMD, rec, 0);
+    } else {
+      emit(c, SCRIPT_LINE, line_add(c, cmd), 0);
+    }
+
+    c->have = 0;
+  }
+}
+
+/* Compile commands, up to one starting with a keyword of 'ends'. */
+static void list(compiler_t *c, const char *const *ends) {
+  const char *cmd;
+
+  while ((cmd = peek(c))) {
+    if (keywords(cmd, ends)) return;
+
+    if (keywords(cmd, reserved)) {
+      syntax(c, cmd);
+      return;
+    }
+
+    statement(c);
+  }
+}
+
+/* Compile the 'len' bytes of the script 'src'. Returns the header followed
+ * by code and pool, NULL if there is an error. */
+static script_hdr_t *compile(const char *path, const char *src, size_t len) {
+  script_hdr_t *hdr = NULL;
+  compiler_t c;
+
+  memset(&c, 0, sizeof (c));
+
+  c.path = path;
+  c.src  = src;
+  c.len  = len;
+
+  list(&c, reserved + 6); // up to a stray '}'
+
+  if (peek(&c)) syntax(&c, c.cmd);
+
+  emit(&c, SCRIPT_END, 0, 0);
+
+  if (!c.error && (hdr = (script_hdr_t *)malloc(sizeof (script_hdr_t) + c.clen + c.plen))) {
+    memset(hdr, 0, sizeof (script_hdr_t));
+    memcpy(hdr->magic, SCRIPT_MAGIC, 4);
+
+    hdr->version = SCRIPT_VERSION;
+    hdr->code    = c.clen;
+    hdr->size    = c.clen + c.plen;
+
+    memcpy(hdr + 1, c.code, c.clen);
+    memcpy((uint8_t *)(hdr + 1) + c.clen, c.pool, c.plen);
+  }
+
+  free(c.buf);
+  free(c.code);
+  free(c.pool);
+
+  return (hdr);
+}
+
+/* Returns the name of the compiled form of 'path', to be freed. */
+static char *cache_name(const char *path) {
+  char *name = (char *)malloc(strlen(path) + sizeof (SCRIPT_SUFFIX) + 16);
+
+  if (name) sprintf(name, "%s%s", path, SCRIPT_SUFFIX);
+
+  return (name);
+}
+
+/* Returns non-zero, if the instruction at 'pc' was marked in 'starts'. */
+static uint8_t marked(const uint8_t *starts, uint16_t code, uint16_t pc) {
+  return ((pc < code) && (starts[pc >> 3] & (1 << (pc & 7))));
+}
+
+/* Returns non-zero, if a string at 'at' ends in the 'size' bytes of
+ * 'pool'. */
+static uint8_t pool_string(const uint8_t *pool, uint32_t size, uint32_t at) {
+  return ((at < size) && memchr(pool + at, '\0', size - at));
+}
+
+/* Returns non-zero, if a command line at 'at' fits in the 'size' bytes of
+ * 'pool'. */
+static uint8_t pool_line(const uint8_t *pool, uint32_t size, uint32_t at) {
+  return ((at + 2 < size) && (at + 3 + get16(pool + at) <= size) &&
+          !pool[at + 2 + get16(pool + at)]);
+}
+
+/* Returns non-zero, if a split command at 'at' fits in the 'size' bytes
+ * of 'pool', with its words in its text and valid operators. */
+static uint8_t pool_command(const uint8_t *pool, uint32_t size, uint32_t at) {
+  const uint8_t *rec = pool + at;
+  uint32_t text;
+  uint16_t len, w;
+  uint8_t i;
+
+  if (at + 4 > size) return (0);
+
+  len  = get16(rec + 2);
+  text = at + 4 + 2 * rec[0];
+
+  if (!len || (text + len > size) || pool[text + len - 1]) return (0);
+
+  for (i=0; i<rec[0]; i++) {
+    w = get16(rec + 4 + 2 * i);
+
+    if (((w & SCRIPT_OP) == SCRIPT_OP) ? ((w & 0xff) >= PARSE_OPS) : (w >= len)) {
+      return (0);
+    }
+  }
+
+  return (1);
+}
+
+/* Check the compiled script 'hdr' read from a file, so that the
+ * interpreter can trust it: the code is a sequence of instructions ending
+ * with SCRIPT_END, jumps go to the start of one, and their operands are
+ * in the pool. Returns 0, if it isn't valid. */
+static uint8_t verify(const script_hdr_t *hdr) {
+  const uint8_t *code = (const uint8_t *)(hdr + 1), *pool = code + hdr->code;
+  uint32_t size = hdr->size - hdr->code;
+  uint8_t *starts, op = 0, ok = 1;
+  uint16_t pc, x;
+
+  if (!hdr->code || !(starts = (uint8_t *)calloc((hdr->code + 7) / 8, 1))) return (0);
+
+  for (pc = 0; pc < hdr->code; pc += sizes[op]) {
+    op = code[pc];
+
+    if ((op >= sizeof (sizes)) || (pc + sizes[op] > hdr->code)) {
+      ok = 0;
+      break;
+    }
+
+    starts[pc >> 3] |= 1 << (pc & 7);
+  }
+
+  if (op != SCRIPT_END) ok = 0;
+
+  for (pc = 0; ok && (pc < hdr->code); pc += sizes[code[pc]]) {
+    x = (sizes[code[pc]] > 1) ? get16(code + pc + 1) : 0;
+
+    switch (code[pc]) {
+      case SCRIPT_CMD:
+        ok = pool_command(pool, size, x);
+        break;
+
+      case SCRIPT_LINE:
+      case SCRIPT_FOR:
+        ok = pool_line(pool, size, x);
+        break;
+
+      case SCRIPT_JMP:
+      case SCRIPT_JF:
+        ok = marked(starts, hdr->code, x);
+        break;
+
+      case SCRIPT_NEXT:
+      case SCRIPT_DEF:
+        ok = pool_string(pool, size, x) && marked(starts, hdr->code, get16(code + pc + 3));
+        break;
+    }
+  }
+
+  free(starts);
+
+  return (ok);
+}
+
+/* Read the compiled form of script 'path', if it was made from the script
+ * as it is now. A compiled form that someone else than the owner of the
+ * script could have written is ignored, as is one that isn't valid. */
+static script_hdr_t *cache_read(const char *path, const struct stat *st) {
+  char *name = cache_name(path);
+  script_hdr_t h, *hdr = NULL;
+  struct stat cs;
+  int fd;
+
+  if (!name) return (NULL);
+
+  if ((fd = open(name, O_RDONLY | O_CLOEXEC)) >= 0) {
+    if (!fstat(fd, &cs) && S_ISREG(cs.st_mode) && (cs.st_uid == st->st_uid) &&
+        !(cs.st_mode & (S_IWGRP | S_IWOTH)) &&
+        (read(fd, &h, sizeof (h)) == sizeof (h)) &&
+        !memcmp(h.magic, SCRIPT_MAGIC, 4) && (h.version == SCRIPT_VERSION) &&
+        (h.sec == st->st_mtim.tv_sec) && (h.nsec == st->st_mtim.tv_nsec) &&
+        (h.csec == st->st_ctim.tv_sec) && (h.cnsec == st->st_ctim.tv_nsec) &&
+        (h.length == st->st_size) && (h.code <= h.size) &&
+        (cs.st_size == (off_t)(sizeof (h) + h.size)) &&
+        (hdr = (script_hdr_t *)malloc(sizeof (h) + h.size))) {
+      *hdr = h;
+
+      if ((read(fd, hdr + 1, h.size) != (ssize_t)h.size) || !verify(hdr)) {
+        free(hdr);
+        hdr = NULL;
+      }
+    }
+
+    close(fd);
+  }
+
+  free(name);
+
+  return (hdr);
+}
+
+/* Store the compiled form of script 'path' next to it, if that's
+ * possible. It's written under a temporary name first, so that other
+ * processes never read a partial one. That name is only used if it's
+ * new, so nothing someone else put there, like a link, is written to. */
+static void cache_write(const char *path, script_hdr_t *hdr) {
+  char *name = cache_name(path), *tmp = cache_name(path);
+  size_t size = sizeof (script_hdr_t) + hdr->size;
+  int fd;
+
+  if (name && tmp) {
+    sprintf(tmp + strlen(tmp), ".%ld", (long)getpid());
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644)) >= 0) {
+      ssize_t n = write(fd, hdr, size);
+
+      close(fd);
+
+      if ((n != (ssize_t)size) || rename(tmp, name)) unlink(tmp);
+    }
+  }
+
+  free(name);
+  free(tmp);
+}
+
+/* Read and compile script 'path'. */
+static script_hdr_t *source(const char *path, const struct stat *st) {
+  script_hdr_t *hdr = NULL;
+  size_t len = 0;
+  char *src;
+  ssize_t n;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    perror(path);
+    return (NULL);
+  }
+
+  if ((src = (char *)malloc(st->st_size + 1))) {
+    while ((len < (size_t)st->st_size) && ((n = read(fd, src + len, st->st_size - len)) > 0)) {
+      len += n;
+    }
+
+    if (len == (size_t)st->st_size) {
+      hdr = compile(path, src, len);
+    } else {
+      perror(path);
+    }
+  }
+
+  close(fd);
+  free(src);
+
+  if (hdr) {
+    hdr->sec    = st->st_mtim.tv_sec;
+    hdr->nsec   = st->st_mtim.tv_nsec;
+    hdr->csec   = st->st_ctim.tv_sec;
+    hdr->cnsec  = st->st_ctim.tv_nsec;
+    hdr->length = st->st_size;
+  }
+
+  return (hdr);
+}
+
+/* Look up the builtins named by the split commands of 's'. */
+static void resolve(script_t *s) {
+  uint16_t pc = 0;
+
+  while (pc < s->hdr->code) {
+    if (s->code[pc] == SCRIPT_CMD) {
+      uint8_t *rec = s->pool + get16(s->code + pc + 1);
+      uint16_t w = get16(rec + 4);
+
+      if (rec[0] && ((w & SCRIPT_OP) != SCRIPT_OP)) {
+        rec[1] = cli_builtin((char *)rec + 4 + 2 * rec[0] + w);
+      }
+    }
+
+    pc += sizes[s->code[pc]];
+  }
+}
+
+/* Forget the functions defined by script 's'. */
+static void funcs_drop(script_t *s) {
+  uint8_t i, n = 0;
+
+  for (i=0; i<nfuncs; i++) {
+    if (funcs[i].script != s) funcs[n++] = funcs[i];
+  }
+
+  nfuncs = n;
+}
+
+/* Returns script 'path', that is compiled or taken from the cache. */
+static script_t *load(const char *path) {
+  script_hdr_t *hdr;
+  struct stat st;
+  script_t *s;
+
+  if (stat(path, &st)) {
+    perror(path);
+    return (NULL);
+  }
+
+  for (s = scripts; s; s = s->next) {
+    if ((s->dev == st.st_dev) && (s->ino == st.st_ino)) break;
+  }
+
+  if (s && (s->hdr->sec == st.st_mtim.tv_sec) && (s->hdr->nsec == st.st_mtim.tv_nsec) &&
+      (s->hdr->csec == st.st_ctim.tv_sec) && (s->hdr->cnsec == st.st_ctim.tv_nsec) &&
+      (s->hdr->length == st.st_size)) {
+    return (s);
+  }
+
+  // a running script that changed is kept, the new one is added before it
+  if (s && s->busy) s = NULL;
+
+  if (!(hdr = cache_read(path, &st))) {
+    if (!(hdr = source(path, &st))) return (NULL);
+
+    cache_write(path, hdr);
+  }
+
+  if (s) {
+    funcs_drop(s);
+    free(s->hdr);
+  } else {
+    if (!(s = (script_t *)calloc(1, sizeof (script_t)))) {
+      free(hdr);
+      return (NULL);
+    }
+
+    s->dev  = st.st_dev;
+    s->ino  = st.st_ino;
+    s->next = scripts;
+    scripts = s;
+  }
+
+  s->hdr  = hdr;
+  s->code = (uint8_t *)(hdr + 1);
+  s->pool = s->code + hdr->code;
+
+  resolve(s);
+
+  return (s);
+}
+
+/* Run the split command 'rec'. */
+static uint8_t run_command(const uint8_t *rec) {
+  char *space[PARSE_ARGS], *text, **argv;
+  uint8_t argc = rec[0], i, ret = 0;
+  uint16_t len = get16(rec + 2);
+  parse_arena_t a;
+
+  parse_arena_init(&a, space, sizeof (space));
+
+  if ((argv = (char **)parse_arena_alloc(&a, (argc + 1) * sizeof (char *))) &&
+      (text = (char *)parse_arena_alloc(&a, len))) {
+    memcpy(text, rec + 4 + 2 * argc, len);
+
+    for (i=0; i<argc; i++) {
+      uint16_t w = get16(rec + 4 + 2 * i);
+
+      argv[i] = ((w & SCRIPT_OP) == SCRIPT_OP) ? (char *)parse_ops[w & 0xff] : text + w;
+    }
+
+    argv[argc] = NULL;
+
+    if (argc) ret = cli_run(argc, argv, &a, rec[1]);
+  }
+
+  parse_arena_free(&a);
+
+  return (ret);
+}
+
+/* Split the command line 'rec' into 'argv' in arena 'a'. */
+static char **split(const uint8_t *rec, parse_arena_t *a, uint8_t *argc) {
+  uint16_t len = get16(rec) + 1;
+  char *line = (char *)parse_arena_alloc(a, len), **argv;
+
+  *argc = 0;
+
+  if (!line) return (NULL);
+
+  memcpy(line, rec + 2, len);
+
+  if (!(argv = parse_args(line, a, argc)) && (*argc == 255)) {
+    printf("argument list too long\n");
+  }
+
+  return (argv);
+}
+
+/* Split and run the command line 'rec'. */
+static uint8_t run_line(const uint8_t *rec) {
+  char *space[PARSE_ARGS], **argv;
+  uint8_t argc, ret = 0;
+  parse_arena_t a;
+
+#ifdef HAVE_EXEC
+  if (parse_shell((const char *)rec + 2)) return (cli_shell((const char *)rec + 2));
+#endif
+
+  parse_arena_init(&a, space, sizeof (space));
+
+  if ((argv = split(rec, &a, &argc)) && argc) {
+    ret = cli_run(argc, argv, &a, cli_builtin(*argv));
+  }
+
+  parse_arena_free(&a);
+
+  return (ret);
+}
+
+/* Run the code of 's' from 'pc' on. Returns 1 to log out, 2 to reset, 0
+ * otherwise. */
+static uint8_t run(script_t *s, uint16_t pc) {
+  struct {
+    parse_arena_t a;
+    char        **argv;
+    uint8_t       argc, i;
+  } loop[SCRIPT_LOOPS];
+  uint8_t loops = 0, ret = 0;
+
+  for (;;) {
+    const uint8_t *ins = s->code + pc;
+    uint16_t x = get16(ins + 1);
+
+    pc += sizes[*ins];
+
+    switch (*ins) {
+      case SCRIPT_CMD:
+        ret = run_command(s->pool + x);
+        break;
+
+      case SCRIPT_LINE:
+        ret = run_line(s->pool + x);
+        break;
+
+      case SCRIPT_JMP:
+        pc = x;
+        break;
+
+      case SCRIPT_JF:
+        if (cli_status()) pc = x;
+        break;
+
+      case SCRIPT_FOR:
+        // only compiled forms that jump into loops can get these wrong
+        if (loops == SCRIPT_LOOPS) goto done;
+
+        parse_arena_init(&loop[loops].a, NULL, 0);
+
+        if (!(loop[loops].argv = split(s->pool + x, &loop[loops].a, &loop[loops].argc))) {
+          loop[loops].argc = 0;
+        }
+
+        loop[loops++].i = 0;
+        break;
+
+      case SCRIPT_NEXT:
+        if (!loops) goto done;
+
+        if (loop[loops - 1].i < loop[loops - 1].argc) {
+          const char *name = (const char *)s->pool + x;
+
+          var_set(name, strlen(name), loop[loops - 1].argv[loop[loops - 1].i++], 0);
+        } else {
+          pc = get16(ins + 3);
+        }
+        break;
+
+      case SCRIPT_DONE:
+        if (!loops) goto done;
+
+        parse_arena_free(&loop[--loops].a);
+        break;
+
+      case SCRIPT_DEF:
+        {
+          const char *name = (const char *)s->pool + x;
+          uint8_t i;
+
+          for (i=0; (i<nfuncs) && strcmp(funcs[i].name, name); i++);
+
+          if (i < SCRIPT_FUNCS) {
+            funcs[i].name   = name;
+            funcs[i].script = s;
+            funcs[i].pc     = pc;
+
+            if (i == nfuncs) nfuncs++;
+          } else {
+            printf("%s: too many functions\n", name);
+          }
+
+          pc = get16(ins + 3);
+        }
+        break;
+
+      case SCRIPT_RET:
+        if (x != SCRIPT_NONE) cli_set_status(x);
+        goto done;
+
+      default:
+        goto done;
+    }
+
+    if (ret) break;
+  }
+
+done:
+  while (loops) parse_arena_free(&loop[--loops].a);
+
+  return (ret);
+}
+
+/* Run 's' from 'pc' on, with the arguments 'argv'. */
+static uint8_t enter(script_t *s, uint16_t pc, uint8_t argc, char **argv) {
+  uint8_t ret, oargc = args_argc;
+  char **oargv = args_argv;
+
+  if (depth == SCRIPT_DEPTH) {
+    printf("%s: nested too deeply\n", *argv);
+    cli_set_status(1);
+    return (0);
+  }
+
+  depth++;
+  s->busy++;
+  args_argc = argc;
+  args_argv = argv;
+
+  ret = run(s, pc);
+
+  args_argc = oargc;
+  args_argv = oargv;
+  s->busy--;
+  depth--;
+
+  return (ret);
+}
+
+/* Run the script 'argv[0]' with the arguments 'argv'. Returns 1 to log
+ * out, 2 to reset, 0 otherwise. */
+uint8_t script_source(uint8_t argc, char **argv) {
+  script_t *s = load(*argv);
+
+  if (!s) {
+    cli_set_status(1);
+    return (0);
+  }
+
+  return (enter(s, 0, argc, argv));
+}
+
+/* Run the function 'argv[0]' with the arguments 'argv'. Returns 0, if
+ * there is no such function, or sets 'ret' like script_source(). */
+uint8_t script_call(uint8_t argc, char **argv, uint8_t *ret) {
+  uint8_t i;
+
+  for (i=0; i<nfuncs; i++) {
+    if (!strcmp(funcs[i].name, *argv)) {
+      *ret = enter(funcs[i].script, funcs[i].pc, argc, argv);
+      return (1);
+    }
+  }
+
+  return (0);
+}
+
+/* Returns the argument $'c' of the running script or function, or their
+ * count for '#'. */
+const char *script_arg(char c) {
+  static char count[4];
+
+  if (c == '#') {
+    sprintf(count, "%u", args_argc ? args_argc - 1 : 0);
+    return (count);
+  }
+
+  if ((c >= '0') && (c - '0' < args_argc)) return (args_argv[c - '0']);
+
+  return (NULL);
+}
+
+void script_fini(void) {
+  while (scripts) {
+    script_t *next = scripts->next;
+
+    free(scripts->hdr);
+    free(scripts);
+    scripts = next;
+  }
+
+  nfuncs = 0;
+}
+
+#endif // HAVE_SCRIPT
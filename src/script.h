@@ -0,0 +1,11 @@
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdint.h>
+
+uint8_t     script_source(uint8_t argc, char **argv);
+uint8_t     script_call(uint8_t argc, char **argv, uint8_t *ret);
+const char *script_arg(char c);
+void        script_fini(void);
+
+#endif // _SCRIPT_H_
@@ -0,0 +1,602 @@
+/* server.c -- many push sessions served by a single process.
+ *
+ * With PUSH_SERVER set to a path, push listens on a unix domain socket
+ * there, instead of using the terminal. Every connection is a session
+ * with its own line editor, history, console and working directory, all
+ * of them driven by one epoll loop. An idle session only holds its state
+ * structures, a few hundred bytes: the output buffer is allocated while
+ * there is something to send, completion and history memory on first use.
+ *
+ * While a session is handled, its console is selected with posix_console()
+ * so that the editor and the builtins write to it. Lines that change the
+ * state of the shell, like cd or export, run right in the loop, whatever
+ * they write to stdout and stderr is collected in the console as well.
+ * All other lines run in a child process, with stdin, stdout and stderr
+ * on the session socket. The session waits for the child through a pidfd
+ * meanwhile, the other sessions go on. Where there are no pidfds, the
+ * children are polled for instead. The child closes the descriptors of
+ * the server and of the other sessions, so that those end when they
+ * should.
+ *
+ * Connect with the terminal in non canonical mode, for example:
+ *
+ *   stty -icanon -echo -isig; socat - UNIX-CONNECT:<path>; stty sane
+ */
+
+#ifdef HAVE_SERVER
+
+#define _GNU_SOURCE // accept4(), memfd_create()
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+
+#include "lined.h"
+#include "term.h"
+#include "cli.h"
+#include "server.h"
+
+#define SERVER_EVENTS  64 // events handled per epoll_wait()
+#define SERVER_BACKLOG 64 // pending connections
+#define SERVER_HISTORY 10 // history length of a session
+
+#define SERVER_COLS    80 // screen size of a session
+#define SERVER_ROWS    24
+
+#define SERVER_POLL    50 // ms between polls for children without a pidfd
+#define SERVER_ORPHANS 16 // children of closed sessions not yet reaped
+
+typedef struct session_t {
+  posix_con_t       con;     /* Console, holds the socket. */
+  lined_t          *lined;   /* Line editor. */
+  lined_history_t  *history; /* History of the editor. */
+  int               cwd;     /* Working directory. */
+  pid_t             pid;     /* Child running the entered line, or 0. */
+  int               pidfd;   /* Watches the child, -1 if it can't. */
+  uint8_t           out;     /* Waiting for the socket to take output. */
+  uint8_t           busy;    /* Is on the busy list. */
+  struct session_t *next;    /* Next session on the busy list. */
+  struct session_t *link;    /* Next of all sessions. */
+} session_t;
+
+static int        epfd = -1;
+static int        lfd = -1;       // listening socket
+static int        home = -1;      // working directory of new sessions
+static int        stdio[3];       // stdin, stdout and stderr of the server
+static session_t *busy = NULL;    // sessions generating completions
+static session_t *current = NULL; // session owning the working directory
+static session_t *sessions = NULL; // all sessions
+static uint16_t   polled = 0;     // children waited for without a pidfd
+
+static pid_t   orphans[SERVER_ORPHANS]; // children of closed sessions
+static uint8_t norphans = 0;
+
+/* Make 's' the session the conio calls and the file system calls work on. */
+static void session_select(session_t *s) {
+  posix_console(&s->con);
+
+  if (current != s) {
+    if (fchdir(s->cwd) < 0) return;
+    current = s;
+  }
+}
+
+/* Send the buffered output of 's'. Unless 'wait' is set, the rest is sent
+ * when the socket can take it. Returns 0 if the connection is broken. */
+static uint8_t session_flush(session_t *s, uint8_t wait) {
+  posix_con_t *c = &s->con;
+  int flags = MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT);
+  uint32_t pos = 0;
+  ssize_t n;
+
+  while (pos < c->olen) {
+    n = send(c->fd, c->out + pos, c->olen - pos, flags);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) return (0);
+      break;
+    }
+
+    pos += n;
+  }
+
+  memmove(c->out, c->out + pos, c->olen - pos);
+  c->olen -= pos;
+
+  // idle sessions don't keep a buffer
+  if (!c->olen) {
+    free(c->out);
+    c->out   = NULL;
+    c->osize = 0;
+  }
+
+  if (!c->olen != !s->out) {
+    struct epoll_event ev;
+
+    s->out = (c->olen > 0);
+
+    ev.events   = EPOLLIN | (s->out ? EPOLLOUT : 0);
+    ev.data.ptr = s;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+
+  return (1);
+}
+
+static void session_close(session_t *s) {
+  session_t **p = &busy;
+
+  while (*p && (*p != s)) p = &(*p)->next;
+  if (*p) *p = s->next;
+
+  for (p = &sessions; *p && (*p != s); p = &(*p)->link);
+  if (*p) *p = s->link;
+
+  if (current == s) current = NULL;
+
+  // the child is reaped later, unless there is no room to remember it
+  if (s->pid) {
+    kill(s->pid, SIGHUP);
+
+    if (waitpid(s->pid, NULL, WNOHANG) == 0) {
+      if (norphans < SERVER_ORPHANS) {
+        orphans[norphans++] = s->pid;
+      } else {
+        waitpid(s->pid, NULL, 0);
+      }
+    }
+
+    if (s->pidfd >= 0) close(s->pidfd); else polled--;
+  }
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, s->con.fd, NULL);
+  close(s->con.fd);
+  close(s->cwd);
+
+  if (s->lined) {
+    cli_release(s->lined);
+    lined_fini(s->lined);
+  }
+  lined_history_fini(s->history);
+
+  free(s->con.out);
+  free(s);
+}
+
+static void session_prompt(session_t *s) {
+  lined_prompt(s->lined, "push:$ ");
+  lined_reset(s->lined, LINED_HISTORY | LINED_COMPLETE | LINED_HINTS | LINED_ECHO);
+}
+
+static void session_open(int fd) {
+  session_t *s = (session_t *)calloc(1, sizeof (session_t));
+  struct epoll_event ev;
+
+  if (!s) {
+    close(fd);
+    return;
+  }
+
+  s->con.fd = fd;
+  s->pidfd  = -1;
+  s->con.w  = SERVER_COLS;
+  s->con.h  = SERVER_ROWS;
+  s->cwd    = fcntl(home, F_DUPFD_CLOEXEC, 0);
+
+  ev.events   = EPOLLIN;
+  ev.data.ptr = s;
+
+  if ((s->cwd < 0) || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+    if (s->cwd >= 0) close(s->cwd);
+    close(fd);
+    free(s);
+    return;
+  }
+
+  s->link  = sessions;
+  sessions = s;
+
+  session_select(s);
+
+  s->history = lined_history_init(SERVER_HISTORY);
+  s->lined   = lined_init(&cli_cb, s->history);
+
+  if (!s->lined) {
+    session_close(s);
+    return;
+  }
+
+  term_clear_screen();
+  session_prompt(s);
+
+  if (!session_flush(s, 0)) session_close(s);
+}
+
+/* Start a child for the line entered in the current session, this is the
+ * cli_detach hook. The child sends the pending output first, then it has
+ * the socket as its terminal. The session stops listening to the socket,
+ * until the child is done. */
+static pid_t session_detach(void) {
+  session_t *s = current, *t;
+  posix_con_t *c = &s->con;
+  struct epoll_event ev;
+  uint32_t pos;
+  ssize_t n;
+  pid_t pid;
+  int i;
+
+  fflush(stdout);
+
+  if ((pid = fork()) < 0) return (pid);
+
+  if (!pid) {
+    for (pos = 0; pos < c->olen; pos += n) {
+      if ((n = send(c->fd, c->out + pos, c->olen - pos, MSG_NOSIGNAL)) < 0) {
+        if (errno != EINTR) _exit(1);
+        n = 0;
+      }
+    }
+
+    for (i=0; i<3; i++) dup2(c->fd, i);
+
+    posix_console_fd(-1);
+
+    // other sessions must see the end of their connection, when they
+    // close it, not when this child is done
+    for (t = sessions; t; t = t->link) {
+      close(t->con.fd);
+      close(t->cwd);
+      if (t->pidfd >= 0) close(t->pidfd);
+    }
+
+    for (i=0; i<3; i++) close(stdio[i]);
+
+    close(home);
+    close(epfd);
+    close(lfd);
+
+    return (0);
+  }
+
+  free(c->out);
+  c->out   = NULL;
+  c->olen  = 0;
+  c->osize = 0;
+
+  s->pid   = pid;
+  s->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+
+  if (s->pidfd >= 0) {
+    ev.events   = EPOLLIN;
+    ev.data.ptr = s;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->pidfd, &ev)) {
+      close(s->pidfd);
+      s->pidfd = -1;
+    }
+  }
+
+  if (s->pidfd < 0) polled++;
+
+  return (pid);
+}
+
+/* Add what the builtins wrote to 'fd' to the console. */
+static void session_collect(int fd) {
+  char buf[256];
+  off_t pos = 0;
+  ssize_t n;
+
+  while ((n = pread(fd, buf, sizeof (buf) - 1, pos)) > 0) {
+    buf[n] = '\0';
+    cputs(buf);
+    pos += n;
+  }
+}
+
+/* Run the entered line, its standard output and error are collected in
+ * the console, unless it runs in a child with session_detach(). */
+static uint8_t session_exec(session_t *s) {
+  int cwd, fd, i;
+  uint8_t ret;
+
+  fflush(stdout);
+
+  if ((fd = memfd_create("push", MFD_CLOEXEC)) >= 0) {
+    for (i=1; i<3; i++) dup2(fd, i);
+  }
+
+  ret = cli_enter(s->lined);
+  fflush(stdout);
+
+  for (i=1; i<3; i++) dup2(stdio[i], i);
+
+  if (fd >= 0) {
+    session_collect(fd);
+    close(fd);
+  }
+
+  if (ret != 3) cli_next(s->lined);
+
+  // cd may have been run
+  if ((cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+    close(s->cwd);
+    s->cwd = cwd;
+  }
+
+  return (ret);
+}
+
+/* Returns the number of bytes at the end of the input of 'c', that start
+ * an escape sequence whose rest has not been received yet. The longest
+ * ones cgetc() reads are 5 bytes, like ESC [ 1 ; 5. */
+static uint8_t session_partial(const posix_con_t *c) {
+  uint8_t i = c->ilen, n, need;
+
+  while ((i > c->ipos) && (c->ilen - i < 5)) {
+    if (c->in[--i] != 27) continue;
+
+    n = c->ilen - i;
+    need = 3;
+
+    if ((n > 2) && (c->in[i + 1] == '[') && (c->in[i + 2] >= '0') && (c->in[i + 2] <= '9')) {
+      need = ((n > 3) && (c->in[i + 3] == '~')) ? 4 : 5;
+    }
+
+    return ((n < need) ? n : 0);
+  }
+
+  return (0);
+}
+
+static uint8_t session_reap(session_t *s);
+
+/* Handle the keys received by 's', up to an incomplete escape sequence
+ * at the end, or a line that runs in a child. Returns 0, if the session
+ * has ended. */
+static uint8_t session_keys(session_t *s) {
+  posix_con_t *c = &s->con;
+  uint8_t key, ret, len = c->ilen;
+
+  c->ilen -= session_partial(c);
+
+  while (!s->pid && (c->ipos < c->ilen)) {
+    key = term_get_key(s->lined);
+
+    if (key == TERM_KEY_ENTER) {
+      ret = session_exec(s);
+    } else {
+      ret = cli_input(s->lined, key);
+    }
+
+    if (ret == 1) return (0);
+
+    if (ret == 2) {
+      term_clear_screen();
+      session_prompt(s);
+    }
+  }
+
+  // keep the rest for the next call
+  c->ilen = len;
+  memmove(c->in, c->in + c->ipos, c->ilen - c->ipos);
+  c->ilen -= c->ipos;
+  c->ipos  = 0;
+
+  // without a pidfd, the child may be done already
+  if (s->pid && (s->pidfd < 0)) return (session_reap(s));
+
+  if (!s->pid && lined_idle(s->lined) && !s->busy) {
+    s->busy = 1;
+    s->next = busy;
+    busy    = s;
+  }
+
+  return (session_flush(s, 0));
+}
+
+/* Reap the child of 's', if it has ended, and go on with the keys typed
+ * ahead. Returns 0, if the session has ended. */
+static uint8_t session_reap(session_t *s) {
+  struct epoll_event ev;
+  int status = 0;
+  pid_t pid;
+
+  while (((pid = waitpid(s->pid, &status, WNOHANG)) < 0) && (errno == EINTR));
+
+  if (!pid) return (1);
+
+  if (s->pidfd >= 0) close(s->pidfd); else polled--;
+
+  s->pid   = 0;
+  s->pidfd = -1;
+  s->out   = 0;
+
+  cli_set_status(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+  ev.events   = EPOLLIN;
+  ev.data.ptr = s;
+
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->con.fd, &ev)) return (0);
+
+  cli_next(s->lined);
+
+  return (session_keys(s));
+}
+
+/* Handle all keys received by 's'. Returns 0, if the session has ended. */
+static uint8_t session_input(session_t *s) {
+  posix_con_t *c = &s->con;
+  ssize_t n;
+
+  n = recv(c->fd, c->in + c->ilen, POSIX_CON_IN - c->ilen, MSG_DONTWAIT);
+
+  if (n == 0) return (0);
+  if (n < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR));
+
+  c->ilen += n;
+
+  return (session_keys(s));
+}
+
+/* Reap the children, that can't be waited for with a pidfd. */
+static void server_poll(void) {
+  session_t *s, *next;
+  uint8_t i, n = 0;
+
+  for (i=0; i<norphans; i++) {
+    if (waitpid(orphans[i], NULL, WNOHANG) == 0) orphans[n++] = orphans[i];
+  }
+
+  norphans = n;
+
+  for (s = sessions; polled && s; s = next) {
+    next = s->link;
+
+    if (!s->pid || (s->pidfd >= 0)) continue;
+
+    session_select(s);
+
+    if (!session_reap(s)) session_close(s);
+  }
+}
+
+/* Let every session on the busy list do a step of its background work. */
+static void server_idle(void) {
+  session_t *s = busy, *next;
+
+  busy = NULL;
+
+  for (; s; s = next) {
+    next = s->next;
+
+    // a line is running, that leaves the editor alone
+    if (s->pid) {
+      s->busy = 0;
+      continue;
+    }
+
+    session_select(s);
+
+    if (lined_idle(s->lined)) {
+      s->next = busy;
+      busy    = s;
+    } else {
+      s->busy = 0;
+    }
+
+    if (!session_flush(s, 0)) session_close(s);
+  }
+}
+
+static int server_listen(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof (addr.sun_path)) return (-1);
+
+  memset(&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return (-1);
+
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) ||
+      listen(fd, SERVER_BACKLOG)) {
+    close(fd);
+    return (-1);
+  }
+
+  return (fd);
+}
+
+/* Serve sessions on the unix socket at 'path', until an error occurs. */
+uint8_t server_run(const char *path) {
+  struct epoll_event ev, events[SERVER_EVENTS];
+  int fd, i, n;
+
+  if ((lfd = server_listen(path)) < 0) {
+    fprintf(stderr, "push: can't listen on %s\n", path);
+    return (1);
+  }
+
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    close(lfd);
+    return (1);
+  }
+
+  ev.events   = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+  for (i=0; i<3; i++) stdio[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+
+  home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  cli_init();
+
+  cli_detach = session_detach;
+
+  for (;;) {
+    n = epoll_wait(epfd, events, SERVER_EVENTS,
+                   busy ? 0 : (polled || norphans) ? SERVER_POLL : -1);
+
+    if ((n < 0) && (errno != EINTR)) break;
+
+    for (i=0; i<n; i++) {
+      session_t *s = (session_t *)events[i].data.ptr;
+
+      if (!s) {
+        if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+          session_open(fd);
+        }
+        continue;
+      }
+
+      session_select(s);
+
+      if (s->pid) {
+        if (!session_reap(s)) session_close(s);
+      } else if ((events[i].events & EPOLLOUT) && !session_flush(s, 0)) {
+        session_close(s);
+      } else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                 !session_input(s)) {
+        session_close(s);
+      }
+    }
+
+    server_poll();
+    server_idle();
+
+    posix_console(NULL);
+  }
+
+  cli_fini();
+
+  close(home);
+  close(epfd);
+  close(lfd);
+  unlink(path);
+
+  return (1);
+}
+
+#endif // HAVE_SERVER
@@ -0,0 +1,8 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+
+uint8_t server_run(const char *path);
+
+#endif // _SERVER_H_
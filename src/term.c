@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 #ifdef POSIX
@@ -15,7 +16,58 @@
 #define POKE(X,Y) (*(unsigned char *)(X))=Y
 #define PEEK(X)   (*(unsigned char *)(X))
 
-static const char *keys = NULL;
+#ifdef HAVE_COMPLETION
+#define MENU_ROWS 8 // max number of menu rows
+
+/* Layout of the completion menu. It is computed once per candidate set,
+ * then only the cells whose selection state changed are redrawn. */
+typedef struct menu_t {
+  uint8_t  shown;  /* Menu is on screen. */
+  uint8_t  y;      /* Screen row of the edited line. */
+  uint8_t  width;  /* Width of a cell. */
+  uint8_t  cols;   /* Cells per row. */
+  uint8_t  rows;   /* Rows on screen. */
+  uint16_t len;    /* Number of candidates laid out. */
+  uint16_t first;  /* First candidate on screen. */
+  uint16_t sel;    /* Selected candidate, len if none. */
+} menu_t;
+#endif
+
+#ifdef HAVE_HIGHLIGHT
+#define TOKEN_MAX (LINED_LENGTH / 2) // one letter words, one space apart
+
+typedef struct token_t {
+  uint8_t start; /* First character. */
+  uint8_t end;   /* One past the last character. */
+  uint8_t type;  /* One of TOKEN_*. */
+} token_t;
+
+/* The tokens of the last highlighted line, along with the text they
+ * were lexed from and the generation of the known commands. The text is
+ * compared rather than tracking the edits, so changes made with ECHO off
+ * or by completion are picked up too. */
+typedef struct lex_t {
+  char    text[LINED_LENGTH];
+  uint8_t len;
+  uint8_t count;
+  token_t token[TOKEN_MAX];
+  uint32_t gen;
+} lex_t;
+#endif
+
+/* The terminal state of a lined instance. */
+struct term_t {
+  const char *keys; /* Keys pushed by term_push_keys(). */
+#ifdef HAVE_OSD
+  uint8_t osd;      /* The OSD is shown. */
+#endif
+#ifdef HAVE_COMPLETION
+  menu_t menu;      /* The completion menu. */
+#endif
+#ifdef HAVE_HIGHLIGHT
+  lex_t lex;        /* Tokens of the last highlighted line. */
+#endif
+};
 
 static void togglecase(void) {
 #ifdef HAVE_PETSCII
@@ -30,8 +82,6 @@ static void clear(uint8_t length) {
 }
 
 #ifdef HAVE_OSD
-static uint8_t osd = 0;
-
 static void hide_osd(lined_t *l) {
   uint8_t i, w = l->cols, x = wherex(), y = wherey();
 
@@ -74,20 +124,321 @@ static void show_osd(lined_t *l) {
 }
 #endif // HAVE_OSD
 
+#ifdef HAVE_COMPLETION
+
+/* The part of a candidate shown in the menu, that is the last word or
+ * path component, keeping a trailing slash. */
+static const char *menu_label(lined_t *l, uint16_t i) {
+  const char *s = l->lc.arena + l->lc.cvec[i];
+  const char *p = s + strlen(s);
+
+  if ((p > s) && (p[-1] == '/')) p--;
+  while ((p > s) && (p[-1] != ' ') && (p[-1] != '/')) p--;
+
+  return (p);
+}
+
+static void menu_layout(lined_t *l) {
+  menu_t *m = &l->term->menu;
+  uint8_t w = 0, h = l->rows - 1;
+  uint16_t i, rows;
+
+  for (i=0; i<l->lc.len; i++) {
+    size_t len = strlen(menu_label(l, i));
+
+    if (len > w) w = (len > 253) ? 253 : (uint8_t)len;
+  }
+
+  w += 2;
+  if (w > l->cols) w = l->cols;
+
+  m->width = w;
+  m->cols  = w ? l->cols / w : 1;
+  if (!m->cols) m->cols = 1;
+
+  rows = (l->lc.len + m->cols - 1) / m->cols;
+
+#ifndef POSIX
+  /* Only the rows below the line, we can't scroll the screen. */
+  h -= m->y;
+#endif
+
+  if (rows > MENU_ROWS) rows = MENU_ROWS;
+  if (rows > h) rows = h;
+
+  m->rows  = (uint8_t)rows;
+  m->len   = l->lc.len;
+  m->first = 0;
+  m->sel   = l->lc.len;
+}
+
+/* Draw the cell of candidate 'i', if it is on screen. */
+static void menu_cell(lined_t *l, uint16_t i) {
+  menu_t *m = &l->term->menu;
+  uint16_t n = i - m->first;
+  const char *label;
+  uint8_t x;
+
+  if ((i < m->first) || (n >= m->cols * m->rows)) return;
+
+  label = menu_label(l, i);
+
+  gotoxy((n % m->cols) * m->width, m->y + 1 + n / m->cols);
+
+  if (i == m->sel) revers(1);
+  textcolor(COLOR_DEFAULT);
+
+  for (x=0; label[x] && (x < m->width - 1); x++) cputc(label[x]);
+
+  if (i == m->sel) revers(0);
+
+  clear(m->width - x);
+}
+
+/* Clear the menu rows. */
+static void menu_clear(lined_t *l) {
+  menu_t *m = &l->term->menu;
+  uint8_t r;
+
+  for (r=1; r<=m->rows; r++) {
+    gotoxy(0, m->y + r);
+    clear(l->cols - 1);
+  }
+}
+
+/* Draw all cells of the current page. */
+static void menu_page(lined_t *l) {
+  menu_t *m = &l->term->menu;
+  uint16_t i, end = m->first + m->cols * m->rows;
+
+  if (end > m->len) end = m->len;
+
+  menu_clear(l);
+
+  for (i=m->first; i<end; i++) menu_cell(l, i);
+}
+
+/* Show the completion candidates in a grid below the edited line and
+ * highlight the selected one. */
+void term_show_menu(lined_t *l) {
+  menu_t *m = &l->term->menu;
+  uint8_t x = wherex(), y = wherey();
+  uint16_t sel = l->lc.index, old = m->sel, page;
+
+  if (!m->shown || (m->len != l->lc.len)) {
+    m->y = y;
+    menu_layout(l);
+
+    if (!m->rows) return;
+
+#ifdef POSIX
+    /* Make room below the line, if it is at the bottom. */
+    if (y + m->rows >= l->rows) {
+      uint8_t i, shift = y + m->rows - (l->rows - 1);
+
+      gotoxy(0, l->rows - 1);
+      for (i=0; i<shift; i++) cputc('\n');
+
+      m->y = y -= shift;
+    }
+#endif
+
+    m->shown = 1;
+    m->sel = sel;
+    menu_page(l);
+  } else if (sel != old) {
+    page = m->cols * m->rows;
+    m->sel = sel;
+
+    if ((sel < m->len) && ((sel < m->first) || (sel >= m->first + page))) {
+      /* Selection left the page, show the one it is on. */
+      m->first = sel - sel % page;
+      menu_page(l);
+    } else {
+      menu_cell(l, old);
+      menu_cell(l, sel);
+    }
+  }
+
+  textcolor(COLOR_DEFAULT);
+  gotoxy(x, y);
+}
+
+/* Remove the completion menu from the screen. */
+void term_hide_menu(lined_t *l) {
+  menu_t *m = &l->term->menu;
+  uint8_t x = wherex(), y = wherey();
+
+  if (!m->shown) return;
+
+  menu_clear(l);
+  m->shown = 0;
+
+  gotoxy(x, y);
+}
+
+#endif // HAVE_COMPLETION
+
+#ifdef HAVE_HIGHLIGHT
+
+
+#define TOKEN_WORD     0
+#define TOKEN_COMMAND  1
+#define TOKEN_UNKNOWN  2
+#define TOKEN_OPTION   3
+#define TOKEN_STRING   4
+#define TOKEN_OPERATOR 5
+
+static const uint8_t token_color[] = {
+  COLOR_WHITE, COLOR_GREEN, COLOR_RED, COLOR_CYAN, COLOR_YELLOW, COLOR_MAGENTA
+};
+
+static uint8_t lex_operator(char c) {
+  return ((c == '|') || (c == ';') || (c == '&') || (c == '<') || (c == '>'));
+}
+
+/* Bring the tokens up to date with 'buf'. Tokens ending before the first
+ * changed character are kept, lexing starts again after the last one. */
+static void lex_line(lined_t *l, const char *buf) {
+  lex_t *lex = &l->term->lex;
+  uint8_t i = 0, n = 0, len = (uint8_t)strlen(buf), start, cmd, type;
+  uint32_t gen = l->cb.commands ? l->cb.commands(l) : 0;
+  char c, quote;
+
+  // the commands are classified again, once the known ones changed
+  if (gen != lex->gen) {
+    lex->gen   = gen;
+    lex->len   = 0;
+    lex->count = 0;
+  }
+
+  while ((i < len) && (i < lex->len) && (buf[i] == lex->text[i])) i++;
+
+  if ((i == len) && (len == lex->len)) return;
+
+  while ((n < lex->count) && (lex->token[n].end < i)) n++;
+
+  i   = n ? lex->token[n-1].end : 0;
+  c   = n ? buf[lex->token[n-1].start] : 0;
+  cmd = !n || ((lex->token[n-1].type == TOKEN_OPERATOR) &&
+               (c != '<') && (c != '>'));
+
+  while ((i < len) && (n < TOKEN_MAX)) {
+    c = buf[i];
+
+    if (c == ' ') {
+      i++;
+      continue;
+    }
+
+    start = i;
+
+    if (lex_operator(c)) {
+      while ((i < len) && lex_operator(buf[i])) i++;
+
+      type = TOKEN_OPERATOR;
+      cmd  = (c != '<') && (c != '>'); // a redirection target follows
+    } else {
+      type  = TOKEN_WORD;
+      quote = 0;
+
+      for (; i < len; i++) {
+        c = buf[i];
+
+        if (quote) {
+          if (c == quote) quote = 0;
+        } else if ((c == ' ') || lex_operator(c)) {
+          break;
+        } else if ((c == '"') || (c == '\'')) {
+          quote = c;
+          type  = TOKEN_STRING;
+        } else if ((c == '\\') && (i + 1 < len)) {
+          i++;
+        }
+      }
+
+      if (cmd) {
+        if (type == TOKEN_WORD) {
+          type = TOKEN_COMMAND;
+
+          if (l->cb.command && !l->cb.command(l, buf + start, i - start)) {
+            type = TOKEN_UNKNOWN;
+          }
+        }
+        cmd = 0;
+      } else if ((type == TOKEN_WORD) && (buf[start] == '-')) {
+        type = TOKEN_OPTION;
+      }
+    }
+
+    lex->token[n].start = start;
+    lex->token[n].end   = i;
+    lex->token[n].type  = type;
+    n++;
+  }
+
+  memcpy(lex->text, buf, len);
+  lex->len   = len;
+  lex->count = n;
+}
+
+/* Write 'len' characters of 'buf' starting at 'first', coloured by the
+ * type of token they belong to. */
+static void show_line(lined_t *l, const char *buf, uint8_t first, uint8_t len) {
+  lex_t *lex = &l->term->lex;
+  uint8_t i, t = 0, color, last = 0xff;
+
+  lex_line(l, buf);
+
+  for (i=first; i<first+len; i++) {
+    while ((t < lex->count) && (lex->token[t].end <= i)) t++;
+
+    color = ((t < lex->count) && (lex->token[t].start <= i)) ?
+            token_color[lex->token[t].type] : COLOR_WHITE;
+
+    if (color != last) textcolor(last = color);
+
+    cputc(buf[i]);
+  }
+}
+
+#endif // HAVE_HIGHLIGHT
+
 #ifdef HAVE_HINTS
 static void show_hint(lined_t *l) {
   if ((l->flags & LINED_HINTS) && (l->plen + l->len < l->cols)) {
-    const char *hint = term_hint_cb(l);
+    const char *hint;
+
+#ifdef HAVE_HISTORY
+    /* A history suggestion continues the line, instead of the hint. */
+    if (l->suggest) {
+      uint8_t max = l->cols - l->plen - l->len - 1;
+      uint8_t i;
+
+#ifdef HAVE_OSD
+      if (l->term->osd && (wherey() < OSD_H)) max -= OSD_W;
+#endif
+
+      textcolor(COLOR_SUGGEST);
+      for (i=0; l->suggest[l->len+i] && (i < max); i++) {
+        cputc(l->suggest[l->len+i]);
+      }
+
+      return;
+    }
+#endif
+
+    hint = l->cb.hint ? l->cb.hint(l) : NULL;
 
     if (hint) {
       uint8_t max = l->cols - l->plen - l->len - 1; // one extra space
       uint8_t i, len = (uint8_t)strlen(hint);
 
 #ifdef HAVE_OSD
-      if (osd && (wherey() < OSD_H)) max -= OSD_W;
+      if (l->term->osd && (wherey() < OSD_H)) max -= OSD_W;
 #endif
 
-      cputc(' ');
+      if (!l->len || (l->buf[l->len-1] != ' ')) cputc(' ');
 
       if (len > max) len = max;
 
@@ -110,6 +461,22 @@ void term_fini(void) {
 #endif
 }
 
+/* Allocate the terminal state of lined instance 'l'. */
+uint8_t term_open(lined_t *l) {
+  l->term = (term_t *)malloc(sizeof (term_t));
+
+  if (!l->term) return (0);
+
+  memset(l->term, 0, sizeof (term_t));
+
+  return (1);
+}
+
+void term_close(lined_t *l) {
+  free(l->term);
+  l->term = NULL;
+}
+
 void term_clear_screen(void) {
   clrscr();
  
@@ -138,13 +505,18 @@ void term_screen_size(uint8_t *cols, uint8_t *rows) {
 
 /* Rewrite the currently edited line accordingly to the buffer content,
  * cursor position, and number of columns of the terminal. */
-void term_refresh_line(lined_t *l, char *buf, uint8_t len) {
+void term_refresh_line(lined_t *l, char *buf, uint8_t first, uint8_t len) {
   uint8_t i, x, y = wherey();
 
+#ifdef HAVE_SWCURSOR
+  /* Character under the cursor. */
+  char c = (l->xpos < len) ? buf[first+l->xpos] : ' ';
+#endif
+
 #ifdef HAVE_OSD
   uint8_t max = l->cols - l->plen;
 
-  if (osd && (y < OSD_H)) max -= OSD_W;
+  if (l->term->osd && (y < OSD_H)) max -= OSD_W;
   if (len > max) len = max;
 #endif
 
@@ -156,8 +528,12 @@ void term_refresh_line(lined_t *l, char *buf, uint8_t len) {
   for (i=0; i<l->plen; i++) cputc(l->prompt[i]);
 
   /* Write the current buffer content */
+#ifdef HAVE_HIGHLIGHT
+  show_line(l, buf, first, len);
+#else
   textcolor(COLOR_WHITE);
-  for (i=0; i<len; i++) cputc(buf[i]);
+  for (i=0; i<len; i++) cputc(buf[first+i]);
+#endif
 
 #ifdef HAVE_HINTS
   /* Write the hint if any */
@@ -169,14 +545,14 @@ void term_refresh_line(lined_t *l, char *buf, uint8_t len) {
   if (x < l->cols) {
     len = l->cols - x;
 #ifdef HAVE_OSD
-    if (osd && (y < OSD_H)) len -= OSD_W;
+    if (l->term->osd && (y < OSD_H)) len -= OSD_W;
 #endif
     clear(len);
   }
 
 #ifdef HAVE_OSD
   /* Show the OSD if enabled. */
-  if (osd) show_osd(l);
+  if (l->term->osd) show_osd(l);
 #endif
 
   /* Calculate screen X position. */
@@ -190,7 +566,7 @@ void term_refresh_line(lined_t *l, char *buf, uint8_t len) {
   if (l->key != TERM_KEY_ENTER) {
     textbackground(COLOR_CYAN);
     textcolor(COLOR_WHITE);
-    cputc((l->pos < l->len) ? l->buf[l->pos] : ' ');
+    cputc(c);
     gotoxy(x, y);
   }
 
@@ -202,16 +578,16 @@ void term_refresh_line(lined_t *l, char *buf, uint8_t len) {
 }
 
 uint8_t term_get_key(lined_t *l) {
-  uint8_t c = keys ? *keys++ : cgetc();
+  uint8_t c = l->term->keys ? *l->term->keys++ : cgetc();
 
 #ifdef POSIX
   // slow down a bit
-  if (keys) usleep(30 * 1000); // 30ms
+  if (l->term->keys) usleep(30 * 1000); // 30ms
 #endif
 
   // end of input stream
-  if (keys && (*keys == 0)) {
-    keys = NULL;
+  if (l->term->keys && (*l->term->keys == 0)) {
+    l->term->keys = NULL;
   }
 
   if ((c == 10) || (c == 13)) c = TERM_KEY_ENTER;
@@ -278,14 +654,14 @@ uint8_t term_get_key(lined_t *l) {
 
 #ifdef HAVE_OSD
   if (c == TERM_KEY_CTRL_O) {
-    osd ^= 1;
+    l->term->osd ^= 1;
 
-    if (!osd) {
+    if (!l->term->osd) {
       hide_osd(l);
     }
   }
 
-  if (osd) {
+  if (l->term->osd) {
     show_osd(l);
   }
 #endif
@@ -312,6 +688,13 @@ void term_make_beep(void) {
 #endif
 }
 
-void term_push_keys(const char *str) {
-  keys = str;
+void term_push_keys(lined_t *l, const char *str) {
+  l->term->keys = str;
 }
+
+#ifdef HAVE_COMPLETION
+/* Returns non zero, if a key is waiting to be read. */
+uint8_t term_key_ready(lined_t *l) {
+  return (l->term->keys || kbhit());
+}
+#endif
@@ -32,6 +32,11 @@
 
 #if defined(M65) || defined(C64)
 #define COLOR_DEFAULT COLOR_GRAY3
+#define COLOR_SUGGEST COLOR_GRAY1
+#elif defined(POSIX)
+#define COLOR_SUGGEST COLOR_GRAY
+#else
+#define COLOR_SUGGEST COLOR_CYAN
 #endif
 
 #include "lined.h"
@@ -79,15 +84,20 @@
 void    term_init(void);
 void    term_fini(void);
 
+uint8_t term_open(lined_t *l);
+void    term_close(lined_t *l);
+
 void    term_make_beep(void);
 void    term_clear_screen(void);
 void    term_screen_size(uint8_t *cols, uint8_t *rows);
 
-void    term_refresh_line(lined_t *l, char *buf, uint8_t len);
+void    term_refresh_line(lined_t *l, char *buf, uint8_t first, uint8_t len);
 
-uint8_t term_get_key(lined_t *l);
-void    term_push_keys(const char *str);
+void    term_show_menu(lined_t *l);
+void    term_hide_menu(lined_t *l);
 
-extern const char *term_hint_cb(lined_t *l);
+uint8_t term_get_key(lined_t *l);
+uint8_t term_key_ready(lined_t *l);
+void    term_push_keys(lined_t *l, const char *str);
 
 #endif // _TERM_H_
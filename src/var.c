@@ -0,0 +1,274 @@
+/* var.c -- shell variables.
+ *
+ * Variables live in an open addressing hash table with linear probing,
+ * that is kept at most half full. Each variable is stored as a single
+ * "name=value" string, so that the exported ones can be handed to commands
+ * as they are. The environment vector of those is maintained along with
+ * the table: setting an exported variable replaces its entry, exporting
+ * one appends it, and unsetting one moves the last entry into its place.
+ * It never has to be rebuilt, and 'environ' points to it, so getenv()
+ * sees the variables of push as well.
+ */
+
+#ifdef HAVE_VARS
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "var.h"
+
+#define VAR_SLOTS   64       // initial size of the table, power of 2
+#define VAR_DELETED (1<<7)   // slot of an unset variable
+
+typedef struct var_t {
+  char    *text;  /* "name=value", NULL if the slot is free. */
+  uint32_t hash;  /* Hash value of the name. */
+  uint16_t env;   /* Index in the environment, if exported. */
+  uint8_t  len;   /* Length of the name. */
+  uint8_t  flags; /* VAR_EXPORT, VAR_DELETED. */
+} var_t;
+
+extern char **environ;
+
+static char   **initial = NULL; // environment push was started with
+
+static var_t   *table = NULL;
+static uint16_t table_size = 0; // number of slots
+static uint16_t table_used = 0; // slots in use, including deleted ones
+
+static char   **envp = NULL;    // exported variables, NULL terminated
+static uint16_t envp_len = 0;
+static uint16_t envp_max = 0;
+
+/* Hash function (FNV-1a) of the first 'len' characters of 'name'. */
+static uint32_t var_hash(const char *name, uint8_t len) {
+  uint32_t h = 2166136261u;
+
+  while (len--) h = (h ^ (uint8_t)*name++) * 16777619u;
+
+  return (h);
+}
+
+/* Returns the slot of the variable, or of the free slot it would go in. */
+static var_t *var_slot(const char *name, uint8_t len, uint32_t hash) {
+  uint16_t i = hash & (table_size - 1);
+  var_t *gap = NULL;
+
+  for (;; i = (i + 1) & (table_size - 1)) {
+    var_t *v = &table[i];
+
+    if (v->flags & VAR_DELETED) {
+      if (!gap) gap = v;
+      continue;
+    }
+
+    if (!v->text) return (gap ? gap : v);
+
+    if ((v->hash == hash) && (v->len == len) && !memcmp(v->text, name, len)) {
+      return (v);
+    }
+  }
+}
+
+/* Double the table, or allocate it. Deleted slots are dropped. */
+static uint8_t var_grow(void) {
+  uint16_t size = table_size ? table_size * 2 : VAR_SLOTS, old_size = table_size, i;
+  var_t *old = table, *v;
+
+  if (!(table = (var_t *)calloc(size, sizeof (var_t)))) {
+    table = old;
+    return (0);
+  }
+
+  // the slots are looked up in the new table
+  table_size = size;
+  table_used = 0;
+
+  for (i=0; i<old_size; i++) {
+    if (!old[i].text) continue;
+
+    v  = var_slot(old[i].text, old[i].len, old[i].hash);
+    *v = old[i];
+    table_used++;
+  }
+
+  free(old);
+
+  return (1);
+}
+
+static uint8_t env_add(var_t *v) {
+  if (envp_len == envp_max) {
+    uint16_t max = envp_max ? envp_max * 2 : 32;
+    char **e = (char **)realloc(envp, (max + 1) * sizeof (char *));
+
+    if (!e) return (0);
+
+    envp = environ = e;
+    envp_max = max;
+  }
+
+  v->env = envp_len;
+  envp[envp_len++] = v->text;
+  envp[envp_len] = NULL;
+
+  return (1);
+}
+
+static void env_del(var_t *v) {
+  char *last = envp[--envp_len];
+
+  // the last entry takes the place of the removed one
+  if (v->env != envp_len) {
+    const char *eq = strchr(last, '=');
+    uint8_t len = eq - last;
+
+    envp[v->env] = last;
+    var_slot(last, len, var_hash(last, len))->env = v->env;
+  }
+
+  envp[envp_len] = NULL;
+}
+
+/* Returns the value of the variable 'name' of length 'len', or NULL. */
+const char *var_get(const char *name, uint8_t len) {
+  var_t *v;
+
+  if (!table) return (NULL);
+
+  v = var_slot(name, len, var_hash(name, len));
+
+  return (v->text ? v->text + len + 1 : NULL);
+}
+
+/* Set variable 'name' of length 'len' to 'value'. With VAR_EXPORT in
+ * 'flags' it's exported, an exported variable stays so. Returns 0, if
+ * there's no memory. */
+uint8_t var_set(const char *name, uint8_t len, const char *value, uint8_t flags) {
+  uint32_t hash = var_hash(name, len);
+  size_t size = strlen(value) + 1;
+  char *text;
+  var_t *v;
+
+  if (((table_used + 1) * 2 > table_size) && !var_grow()) return (0);
+
+  if (!(text = (char *)malloc(len + 1 + size))) return (0);
+
+  memcpy(text, name, len);
+  text[len] = '=';
+  memcpy(text + len + 1, value, size);
+
+  v = var_slot(name, len, hash);
+
+  if (v->text) {
+    free(v->text);
+
+    if (v->flags & VAR_EXPORT) envp[v->env] = text;
+  } else {
+    if (!(v->flags & VAR_DELETED)) table_used++;
+
+    v->hash  = hash;
+    v->len   = len;
+    v->flags = 0;
+  }
+
+  v->text = text;
+
+  if ((flags & VAR_EXPORT) && !(v->flags & VAR_EXPORT)) {
+    if (env_add(v)) v->flags |= VAR_EXPORT;
+  }
+
+  return (1);
+}
+
+/* Export the variable 'name' of length 'len'. Returns 0, if it's unset. */
+uint8_t var_export(const char *name, uint8_t len) {
+  var_t *v;
+
+  if (!table) return (0);
+
+  v = var_slot(name, len, var_hash(name, len));
+
+  if (!v->text) return (0);
+
+  if (!(v->flags & VAR_EXPORT) && env_add(v)) v->flags |= VAR_EXPORT;
+
+  return (1);
+}
+
+void var_unset(const char *name, uint8_t len) {
+  var_t *v;
+
+  if (!table) return;
+
+  v = var_slot(name, len, var_hash(name, len));
+
+  if (!v->text) return;
+
+  if (v->flags & VAR_EXPORT) env_del(v);
+
+  free(v->text);
+  v->text  = NULL;
+  v->flags = VAR_DELETED;
+}
+
+/* Returns the length of the variable name at the start of 's', 0 if it
+ * doesn't start with one. */
+uint8_t var_name(const char *s) {
+  uint8_t n = 0;
+
+  if (((*s < 'A') || (*s > 'Z')) && ((*s < 'a') || (*s > 'z')) && (*s != '_')) {
+    return (0);
+  }
+
+  while ((n < 255) &&
+         (((s[n] >= 'A') && (s[n] <= 'Z')) || ((s[n] >= 'a') && (s[n] <= 'z')) ||
+          ((s[n] >= '0') && (s[n] <= '9')) || (s[n] == '_'))) {
+    n++;
+  }
+
+  return (n);
+}
+
+/* Returns the environment for commands, the exported variables. */
+char **var_envp(void) {
+  return (envp);
+}
+
+/* Import the environment push was started with. */
+void var_init(void) {
+  char **e;
+
+  initial = environ;
+
+  for (e = initial; e && *e; e++) {
+    const char *eq = strchr(*e, '=');
+
+    if (!eq || (eq - *e > 255)) continue;
+
+    var_set(*e, eq - *e, eq + 1, VAR_EXPORT);
+  }
+
+  // commands get an environment, even if it's empty
+  if (!envp && (envp = (char **)calloc(1, sizeof (char *)))) {
+    environ = envp;
+  }
+}
+
+void var_fini(void) {
+  uint16_t i;
+
+  environ = initial;
+
+  for (i=0; i<table_size; i++) free(table[i].text);
+
+  free(table);
+  free(envp);
+
+  table = NULL;
+  envp  = NULL;
+  table_size = table_used = envp_len = envp_max = 0;
+}
+
+#endif // HAVE_VARS
@@ -0,0 +1,19 @@
+#ifndef _VAR_H_
+#define _VAR_H_
+
+#include <stdint.h>
+
+#define VAR_EXPORT (1<<0) // variable is in the environment of commands
+
+void        var_init(void);
+void        var_fini(void);
+
+const char *var_get(const char *name, uint8_t len);
+uint8_t     var_set(const char *name, uint8_t len, const char *value, uint8_t flags);
+uint8_t     var_export(const char *name, uint8_t len);
+void        var_unset(const char *name, uint8_t len);
+
+uint8_t     var_name(const char *s);
+char      **var_envp(void);
+
+#endif // _VAR_H_